@@ -0,0 +1,248 @@
+#include "bvh.h"
+#include "simd.h"
+#include "draw.h"
+#include <algorithm>
+
+std::vector<BVHNode> bvhNodes;
+WorldBoxes bvhBoxes;
+std::vector<WorldBounds> bvhBounds;
+
+bool cullHierarchy = true;
+
+static std::vector<ModelCollection*> bvhObjects; //object of each entry of worldBounds
+static std::vector<uint32_t> buildOrder; //objects (indices into the models given to buildBVH) in the order of the hierarchy
+
+//results of frustum tests, indexed like bvhNodes and worldBounds -- kept between frames so their memory is reused
+static std::vector<uint8_t> nodeInside;
+static std::vector<uint8_t> objectInside;
+
+static std::vector<uint32_t> nodeStack; //nodes still to be looked at by cullBVH, the next one at the back
+
+//add a node with the box around objects first..first + count - 1 of buildOrder, and return its index
+static uint32_t addNode(uint32_t first, uint32_t count) {
+	GLfloat minX = worldBoxes.minX[buildOrder[first]], maxX = worldBoxes.maxX[buildOrder[first]];
+	GLfloat minY = worldBoxes.minY[buildOrder[first]], maxY = worldBoxes.maxY[buildOrder[first]];
+	GLfloat minZ = worldBoxes.minZ[buildOrder[first]], maxZ = worldBoxes.maxZ[buildOrder[first]];
+	for (uint32_t i = first + 1; i < first + count; i++) {
+		uint32_t o = buildOrder[i];
+		minX = std::min(minX, worldBoxes.minX[o]);
+		minY = std::min(minY, worldBoxes.minY[o]);
+		minZ = std::min(minZ, worldBoxes.minZ[o]);
+		maxX = std::max(maxX, worldBoxes.maxX[o]);
+		maxY = std::max(maxY, worldBoxes.maxY[o]);
+		maxZ = std::max(maxZ, worldBoxes.maxZ[o]);
+	}
+
+	bvhBoxes.minX.push_back(minX);
+	bvhBoxes.minY.push_back(minY);
+	bvhBoxes.minZ.push_back(minZ);
+	bvhBoxes.maxX.push_back(maxX);
+	bvhBoxes.maxY.push_back(maxY);
+	bvhBoxes.maxZ.push_back(maxZ);
+
+	//corner k has the max x if bit 1 of k is set, the max y if bit 2 is, and the max z if bit 4 is
+	WorldBounds b;
+	for (int k = 0; k < 8; k++) {
+		b.cornerX[k] = k & 1 ? maxX : minX;
+		b.cornerY[k] = k & 2 ? maxY : minY;
+		b.cornerZ[k] = k & 4 ? maxZ : minZ;
+	}
+	b.center = glm::vec3(minX + maxX, minY + maxY, minZ + maxZ) * 0.5f;
+	b.radius = glm::length(glm::vec3(maxX - minX, maxY - minY, maxZ - minZ)) * 0.5f;
+	bvhBounds.push_back(b);
+
+	BVHNode node;
+	node.first = first;
+	node.count = count;
+	node.child = 0;
+	bvhNodes.push_back(node);
+	return (uint32_t)bvhNodes.size() - 1;
+}
+
+//center of an object's box along an axis (0 = x, 1 = y, 2 = z), times 2
+static GLfloat boxCenter(uint32_t o, int axis) {
+	switch (axis) {
+	case 0:
+		return worldBoxes.minX[o] + worldBoxes.maxX[o];
+	case 1:
+		return worldBoxes.minY[o] + worldBoxes.maxY[o];
+	default:
+		return worldBoxes.minZ[o] + worldBoxes.maxZ[o];
+	}
+}
+
+//split a node in two at the median of its objects' centers along the axis where the centers are most spread out, and split its children too
+static void splitNode(uint32_t n) {
+	uint32_t first = bvhNodes[n].first;
+	uint32_t count = bvhNodes[n].count;
+	if (count <= BVH_LEAF_SIZE) {
+		return;
+	}
+
+	//spread of the centers along each axis
+	GLfloat minC[3], maxC[3];
+	for (int axis = 0; axis < 3; axis++) {
+		minC[axis] = maxC[axis] = boxCenter(buildOrder[first], axis);
+		for (uint32_t i = first + 1; i < first + count; i++) {
+			GLfloat c = boxCenter(buildOrder[i], axis);
+			minC[axis] = std::min(minC[axis], c);
+			maxC[axis] = std::max(maxC[axis], c);
+		}
+	}
+	int axis = 0;
+	for (int a = 1; a < 3; a++) {
+		if (maxC[a] - minC[a] > maxC[axis] - minC[axis]) {
+			axis = a;
+		}
+	}
+
+	//half of the objects on each side
+	uint32_t half = count / 2;
+	std::nth_element(buildOrder.begin() + first, buildOrder.begin() + first + half, buildOrder.begin() + first + count,
+		[axis](uint32_t a, uint32_t b) { return boxCenter(a, axis) < boxCenter(b, axis); });
+
+	//the children are next to each other, and are split once both exist
+	uint32_t left = addNode(first, half);
+	uint32_t right = addNode(first + half, count - half);
+	bvhNodes[n].child = left;
+	splitNode(left);
+	splitNode(right);
+}
+
+//build hierarchy and put the bounds of the objects in its order -- see header
+void buildBVH(std::vector<ModelCollection>& models) {
+	bvhNodes.clear();
+	bvhBoxes = WorldBoxes();
+	bvhBounds.clear();
+	bvhObjects.clear();
+	if (models.empty()) {
+		return;
+	}
+
+	buildOrder.resize(models.size());
+	for (uint32_t i = 0; i < buildOrder.size(); i++) {
+		buildOrder[i] = models[i].boundsIndex;
+	}
+	splitNode(addNode(0, (uint32_t)models.size()));
+
+	//bounds of the objects in the new order
+	std::vector<WorldBounds> bounds(worldBounds.size());
+	WorldBoxes boxes;
+	std::vector<uint32_t> modelOf(worldBounds.size()); //model that each old entry of worldBounds belongs to
+	for (uint32_t i = 0; i < models.size(); i++) {
+		modelOf[models[i].boundsIndex] = i;
+	}
+	for (uint32_t i = 0; i < buildOrder.size(); i++) {
+		uint32_t o = buildOrder[i];
+		bounds[i] = worldBounds[o];
+		boxes.minX.push_back(worldBoxes.minX[o]);
+		boxes.minY.push_back(worldBoxes.minY[o]);
+		boxes.minZ.push_back(worldBoxes.minZ[o]);
+		boxes.maxX.push_back(worldBoxes.maxX[o]);
+		boxes.maxY.push_back(worldBoxes.maxY[o]);
+		boxes.maxZ.push_back(worldBoxes.maxZ[o]);
+
+		ModelCollection& m = models[modelOf[o]];
+		m.boundsIndex = i;
+		bvhObjects.push_back(&m);
+	}
+	worldBounds.swap(bounds);
+	worldBoxes = boxes;
+
+	nodeInside.assign(bvhNodes.size(), 1);
+	objectInside.assign(worldBounds.size(), 1);
+}
+
+//squared distance from a point to the nearest point of a node's box (0 if it's inside the box)
+static GLfloat nodeDistance2(uint32_t n, const glm::vec3& p) {
+	glm::vec3 nearest(std::min(std::max(p.x, bvhBoxes.minX[n]), bvhBoxes.maxX[n]),
+		std::min(std::max(p.y, bvhBoxes.minY[n]), bvhBoxes.maxY[n]),
+		std::min(std::max(p.z, bvhBoxes.minZ[n]), bvhBoxes.maxZ[n]));
+	glm::vec3 d = nearest - p;
+	return glm::dot(d, d);
+}
+
+//write every object of a node to order as not drawn
+static void rejectNode(const BVHNode& node, std::vector<ModelCollection*>& order, std::vector<int>& flags, size_t& next) {
+	for (uint32_t i = node.first; i < node.first + node.count; i++) {
+		order[next] = bvhObjects[i];
+		flags[next] = 0;
+		next++;
+	}
+}
+
+//cull all objects with the hierarchy -- see header
+void cullBVH(std::vector<ModelCollection*>& order, std::vector<int>& flags) {
+	if (bvhNodes.empty()) {
+		return;
+	}
+
+	glm::vec3 eye = glm::vec3(glm::inverse(view)[3]); //camera position in world space
+	size_t next = 0; //next entry of order to write to
+
+	nodeStack.clear();
+	frustumTest(bvhBoxes, 0, 1, frustumPlanes, nodeInside.data());
+	if (nodeInside[0]) {
+		nodeStack.push_back(0);
+	} else {
+		rejectNode(bvhNodes[0], order, flags, next);
+	}
+
+	while (!nodeStack.empty()) {
+		uint32_t n = nodeStack.back();
+		nodeStack.pop_back();
+		const BVHNode& node = bvhNodes[n];
+
+		//everything nearer than this node was rendered already, so if its box is hidden, all of its objects are
+		if (!boxVisible(bvhBounds[n])) {
+			rejectNode(node, order, flags, next);
+			continue;
+		}
+
+		if (node.child == 0) {
+			//objects of the leaf that are inside the frustum are tested nearest first, the others aren't drawn
+			frustumTest(worldBoxes, node.first, node.first + node.count, frustumPlanes, objectInside.data());
+			SortEntry inside[BVH_LEAF_SIZE];
+			size_t insideCount = 0;
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				if (objectInside[i]) {
+					inside[insideCount++] = { distSquaredToCamera(*bvhObjects[i]), bvhObjects[i] };
+				}
+			}
+			for (size_t i = 1; i < insideCount; i++) { //insertion sort -- there are at most BVH_LEAF_SIZE of them
+				SortEntry e = inside[i];
+				size_t k = i;
+				for (; k > 0 && e.key < inside[k - 1].key; k--) {
+					inside[k] = inside[k - 1];
+				}
+				inside[k] = e;
+			}
+			for (size_t i = 0; i < insideCount; i++) {
+				order[next] = inside[i].m;
+				flags[next] = shouldDraw(*inside[i].m) ? 1 : 0;
+				next++;
+			}
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				if (!objectInside[i]) {
+					order[next] = bvhObjects[i];
+					flags[next] = 0;
+					next++;
+				}
+			}
+			continue;
+		}
+
+		//children inside the frustum are looked at nearest first, so the nearer one goes on the stack last
+		uint32_t c = node.child;
+		frustumTest(bvhBoxes, c, c + 2, frustumPlanes, nodeInside.data());
+		uint32_t nearChild = nodeDistance2(c, eye) <= nodeDistance2(c + 1, eye) ? c : c + 1;
+		uint32_t farChild = nearChild == c ? c + 1 : c;
+		for (uint32_t child : { farChild, nearChild }) {
+			if (nodeInside[child]) {
+				nodeStack.push_back(child);
+			} else {
+				rejectNode(bvhNodes[child], order, flags, next);
+			}
+		}
+	}
+}
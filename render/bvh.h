@@ -0,0 +1,47 @@
+#pragma once
+
+/*		bounding volume hierarchy file
+
+	a binary tree of world space boxes over the objects of the scene, made once by bakeScene
+
+	culling walks the tree front to back: a node outside the view frustum, or whose box is hidden
+	according to the depth buffer, is rejected with all of its objects at once, so the cost of culling
+	grows with what is seen rather than with the size of the scene
+
+	the objects of every node are next to each other in worldBounds and worldBoxes (bakeScene puts them
+	in this order), so a node is just a range of objects
+*/
+
+#include "cull.h"
+#include <vector>
+
+//most objects in a leaf -- the objects of a leaf are tested against the frustum at once with the SIMD kernels
+#define BVH_LEAF_SIZE 8
+
+//one node of the hierarchy
+struct BVHNode {
+	uint32_t first; //first object of this node (index into worldBounds)
+	uint32_t count; //number of objects in this node
+	uint32_t child; //index of the first of the two children (the other one is next to it), or 0 for leaves
+};
+
+extern std::vector<BVHNode> bvhNodes; //nodes of the hierarchy, the root is the first one
+extern WorldBoxes bvhBoxes; //axis aligned box of each node, for frustum tests
+extern std::vector<WorldBounds> bvhBounds; //corners of the same boxes, for depth tests
+
+extern bool cullHierarchy; //cull with the hierarchy? otherwise every object is culled one by one -- -flat turns it off
+
+/*	build the hierarchy over these objects
+
+	worldBounds and worldBoxes should already have the bounds of every object (in the order of models) -- they are
+	put in the order of the hierarchy, and the boundsIndex of every object is changed to match
+*/
+void buildBVH(std::vector<ModelCollection>& models);
+
+/*	cull every object of the scene by walking the hierarchy front to back -- call after startCulling
+
+	objects are written to order in the order they were looked at, and flags[i] is set to 1 if order[i] should be
+	drawn or 0 if not -- both must have room for every object
+	objects in a node that is visible are tested with shouldDraw (nearest first), which also renders their occluders
+*/
+void cullBVH(std::vector<ModelCollection*>& order, std::vector<int>& flags);
@@ -242,7 +242,7 @@ void handleInput() {
 
 /*	handle mouse movement if not in playback mode
 */
-void cursorCallback(GLFWwindow* window, double xPos, double yPos) {
+void cursorCallback(GLFWwindow*, double xPos, double yPos) {
 	if (replayMode == PLAY) {
 		return;
 	}
@@ -1,14 +1,36 @@
 #include "cull.h"
+#include "simd.h"
+#include "threads.h"
 #include "utility.h"
+#include <iostream>
 #include <vector>
 #include <algorithm>
+#include <thread>
 #include "draw.h"
 #include <cmath>
+#include <chrono>
 #include <glm/gtc/matrix_transform.hpp>
 #include "control.h"
+#include "bvh.h"
+#include "raster.h"
+
+static_assert(BIN_WIDTH % PYRAMID_FACTOR == 0 && BIN_HEIGHT % PYRAMID_FACTOR == 0, "level 1 cells of the pyramid must not span several bins");
 
 DepthBuffer dBuffer;
 
+bool preciseTest = false;
+bool sharedRendering = false;
+bool batchedCulling = false;
+int batchOccluders = BATCH_OCCLUDERS;
+bool keepDepths = false;
+bool visibleFirst = false;
+bool occluderBudget = false;
+int budgetTriangles = OCCLUDER_BUDGET;
+bool timeBudget = false;
+double budgetMicroseconds = 0.0;
+size_t skippedOccluders = 0;
+size_t skippedTriangles = 0;
+
 /*
 	pixel space is like canvas coordinates in WebGL -- top left is 0,0 and right/down is positive
 
@@ -38,298 +60,746 @@ uint32_t line(uint32_t e0, uint32_t e1, uint32_t e2, uint32_t o0, uint32_t o1, u
 	return m0 & m1 & m2;
 }
 
-/*	render bit mask of triangle into depth buffer -- see header for details
+//Get bit mask for one scanline of a block 64 pixels wide -- see header file for details
+uint64_t line(uint32_t e0, uint32_t e1, uint32_t e2, uint64_t o0, uint64_t o1, uint64_t o2) {
+	uint64_t m0 = e0 >= 64 ? 0 : (~(uint64_t)0 >> e0);
+	uint64_t m1 = e1 >= 64 ? 0 : (~(uint64_t)0 >> e1);
+	uint64_t m2 = e2 >= 64 ? 0 : (~(uint64_t)0 >> e2);
+	return (m0 ^ o0) & (m1 ^ o1) & (m2 ^ o2);
+}
 
-	only for debugging and visualizing the rasterization -- not part of culling logic
-*/
-void rasterize(glm::vec2 t1, glm::vec2 t2, glm::vec2 t3) {
-	fixTriangle(t1, t2, t3); //ensure y coords are all different
-
-	//centroid
-	GLfloat cx = (t1.x + t2.x + t3.x) / 3.0f;
-	GLfloat cy = (t1.y + t2.y + t3.y) / 3.0f;
-	glm::vec2 center(cx, cy);
-
-	//sort points by decreasing height
-	std::vector<glm::vec2*> ps;
-	ps.push_back(&t1);
-	ps.push_back(&t2);
-	ps.push_back(&t3);
-	std::sort(ps.begin(), ps.end(), triComp);
-
-	glm::vec2& p1 = *ps[0];
-	glm::vec2& p2 = *ps[1];
-	glm::vec2& p3 = *ps[2];
-
-	//downward-pointing edges
-	glm::vec2 l1 = p2 - p1;
-	glm::vec2 l2 = p3 - p1;
-	glm::vec2 l3 = p3 - p2;
-
-	//left-facing normals (because edges are downward facing)
-	glm::vec2 n1(l1.y, -l1.x);
-	glm::vec2 n2(l2.y, -l2.x);
-	glm::vec2 n3(l3.y, -l3.x);
-
-	//true if left is outside of the triangle
-	bool o1 = glm::dot(n1, (center - p1)) < 0; //point in triangle test for one edge -- but with left-facing normal
-	bool o2 = glm::dot(n2, (center - p1)) < 0;
-	bool o3 = glm::dot(n3, (center - p2)) < 0;
-	uint32_t mask1 = o1 ? 0 : ~0;
-	uint32_t mask2 = o2 ? 0 : ~0;
-	uint32_t mask3 = o3 ? 0 : ~0;
-
-	//move along line to the top of the screen (y = 1.0)
-	glm::vec2 f1 = p1 + ((1.0f - p1.y) / l1.y) * l1;
-	glm::vec2 f2 = p1 + ((1.0f - p1.y) / l2.y) * l2;
-	glm::vec2 f3 = p2 + ((1.0f - p2.y) / l3.y) * l3;
-
-	//convert points at top of screen, and points, into pixel space
-	convertVec(f1);
-	convertVec(f2);
-	convertVec(f3);
-	convertVec(p1);
-	convertVec(p2);
-	convertVec(p3);
-
-	//remake line vectors in pixel space
-	l1 = p2 - p1;
-	l2 = p3 - p1;
-	l3 = p3 - p2;
-	// dx/dy slopes of each edge
-	GLfloat s1 = l1.x / l1.y;
-	GLfloat s2 = l2.x / l2.y;
-	GLfloat s3 = l3.x / l3.y;
-
-	//bounding square of triangle in pixel space
-	GLfloat minY = std::min(p1.y, std::min(p2.y, p3.y));
-	GLfloat maxY = std::max(p1.y, std::max(p2.y, p3.y));
-	GLfloat minX = std::min(p1.x, std::min(p2.x, p3.x));
-	GLfloat maxX = std::max(p1.x, std::max(p2.x, p3.x));
-
-	//coordinate ranges of blocks possibly overlapping triangle
-	int iStart = std::max(((int)minY) / BLOCK_HEIGHT, 0);
-	int iEnd = std::min(((int)maxY) / BLOCK_HEIGHT, (int)dBuffer.heightB - 1);
-
-	int jStart = std::max(((int)minX) / 32, 0);
-	int jEnd = std::min(((int)maxX) / 32, (int)dBuffer.widthB - 1);
+//point in fixed point pixel space, with SUBPIXEL_BITS bits of fraction
+struct FixedPoint {
+	int64_t x, y;
+};
+
+//put a and b in order of increasing y -- selects instead of branches, so the compiler can use conditional moves
+static inline void sortPair(FixedPoint& a, FixedPoint& b) {
+	bool swap = b.y < a.y;
+	FixedPoint top = swap ? b : a;
+	FixedPoint bottom = swap ? a : b;
+	a = top;
+	b = bottom;
+}
 
-	for (int i = iStart; i <= iEnd; i++) { //iterate over height
-		int scanBase = i * BLOCK_HEIGHT; //height of top scanline (pixel space)
+/*	edge from a to b (with a.y <= b.y) -- see EdgeSetup
 
-		//compute events for each scanline in pixel space
-		GLfloat e1f[BLOCK_HEIGHT];
-		GLfloat e2f[BLOCK_HEIGHT];
-		GLfloat e3f[BLOCK_HEIGHT];
+	the edge crosses the center of scanline y (at y + 0.5) at x = a.x + (y + 0.5 - a.y) * dx / dy, and its event is
+	the first pixel with its center at or right of that, ceil(x - 0.5) -- everything is multiplied out so it's exact
+	horizontal edges only limit the scanlines the triangle covers, which is done with yStart and yEnd instead,
+	so their events are far left of every block
+*/
+static void setupEdge(const FixedPoint& a, const FixedPoint& b, EdgeSetup& e) {
+	const int64_t one = 1 << SUBPIXEL_BITS;
+	const int64_t half = one >> 1;
+	int64_t dx = b.x - a.x;
+	int64_t dy = b.y - a.y;
+	if (dy == 0) {
+		e.n = -EVENT_FAR;
+		e.r = 0;
+		e.d = 1;
+		e.q = 0;
+		return;
+	}
 
-		e1f[0] = f1.x + (GLfloat)scanBase * s1;
-		e2f[0] = f2.x + (GLfloat)scanBase * s2;
-		e3f[0] = f3.x + (GLfloat)scanBase * s3;
+	e.d = one * dy;
+	e.n = (a.x - half) * dy + (half - a.y) * dx;
+	e.q = floorDiv(dx, dy);
+	e.r = one * dx - e.q * e.d;
+}
 
-		for (int r = 1; r < BLOCK_HEIGHT; r++) {
-			e1f[r] = e1f[r - 1] + s1;
-			e2f[r] = e2f[r - 1] + s2;
-			e3f[r] = e3f[r - 1] + s3;
-		}
 
+/*	render bit mask of triangle into depth buffer -- see header for details
+
+	only for debugging and visualizing the rasterization -- not part of culling logic
+*/
+template<int WIDTH, int HEIGHT>
+static void rasterizeBlocks(glm::vec2 t1, glm::vec2 t2, glm::vec2 t3) {
+	TriangleSetup t;
+	setupTriangle(glm::vec3(t1, 0.0f), glm::vec3(t2, 0.0f), glm::vec3(t3, 0.0f), t);
+	int jStart = t.jStart;
+	int jEnd = t.jEnd;
+
+	//edge flip masks as wide as a scanline
+	BlockMask<WIDTH> mask1 = t.mask1 ? ~(BlockMask<WIDTH>)0 : 0;
+	BlockMask<WIDTH> mask2 = t.mask2 ? ~(BlockMask<WIDTH>)0 : 0;
+	BlockMask<WIDTH> mask3 = t.mask3 ? ~(BlockMask<WIDTH>)0 : 0;
+
+	TriangleWalk walk;
+	walk.start(t, t.iStart * HEIGHT);
+	for (int i = t.iStart; i <= t.iEnd; i++) { //iterate over height
+		//compute events for each scanline
+		int32_t e1x[HEIGHT];
+		int32_t e2x[HEIGHT];
+		int32_t e3x[HEIGHT];
+		walk.events(t, HEIGHT, e1x, e2x, e3x);
+
+		dBuffer.touch<WIDTH, HEIGHT>(i, jStart, jEnd);
+		BlockRow<WIDTH, HEIGHT> row = dBuffer.row<WIDTH, HEIGHT>(i);
 		for (int j = jStart; j <= jEnd; j++) { //iterate over width
-			Block& b = dBuffer.getBlock(j, i);
+			BlockMask<WIDTH>* bits = row.bits + j * HEIGHT; //masks of this block
 
-			for (int k = 0; k < BLOCK_HEIGHT; k++) { //rasterize into entire block
+			for (int k = 0; k < HEIGHT; k++) { //rasterize into entire block
 				//actual events relative to this block
-				uint32_t e1 = std::max(0.0f, e1f[k] - j * 32.0f);
-				uint32_t e2 = std::max(0.0f, e2f[k] - j * 32.0f);
-				uint32_t e3 = std::max(0.0f, e3f[k] - j * 32.0f);
+				uint32_t e1 = std::max(0, e1x[k] - j * WIDTH);
+				uint32_t e2 = std::max(0, e2x[k] - j * WIDTH);
+				uint32_t e3 = std::max(0, e3x[k] - j * WIDTH);
 
-				uint32_t result = line(e1, e2, e3, mask1, mask2, mask3);
-				b.bits[k] |= result;
+				BlockMask<WIDTH> result = line(e1, e2, e3, mask1, mask2, mask3);
+				bits[k] |= result;
 			}
 		}
 	}
 }
 
-//clear block by settings its depths to 1.0 (the maximum depth) and clearing mask
-void Block::reset() { //reset as specified by the Hasselgren et al. paper
-	for (int i = 0; i < BLOCK_HEIGHT; i++) {
-		bits[i] = 0;
+void rasterize(glm::vec2 t1, glm::vec2 t2, glm::vec2 t3) {
+	switch (dBuffer.blockHeight) {
+	case 4:
+		if (dBuffer.blockWidth == 64) {
+			rasterizeBlocks<64, 4>(t1, t2, t3);
+		} else {
+			rasterizeBlocks<32, 4>(t1, t2, t3);
+		}
+		break;
+	case 16:
+		if (dBuffer.blockWidth == 64) {
+			rasterizeBlocks<64, 16>(t1, t2, t3);
+		} else {
+			rasterizeBlocks<32, 16>(t1, t2, t3);
+		}
+		break;
+	default:
+		if (dBuffer.blockWidth == 64) {
+			rasterizeBlocks<64, 8>(t1, t2, t3);
+		} else {
+			rasterizeBlocks<32, 8>(t1, t2, t3);
+		}
 	}
-	reference = 1.0f;
-	working = 0.0f;
+}
+
+//true if the culling code is compiled for blocks of this height -- see header
+bool supportedBlockHeight(int blockHeight) {
+	return blockHeight == 4 || blockHeight == 8 || blockHeight == 16;
+}
 
+//true if the culling code is compiled for blocks of this width -- see header
+bool supportedBlockWidth(int blockWidth) {
+	return blockWidth == 32 || blockWidth == 64;
 }
 
-//construct depth buffer and allocate blocks
+//construct depth buffer of the default size
 DepthBuffer::DepthBuffer() {
-	widthB = (BUFFER_WIDTH / 32);
-	heightB = (BUFFER_HEIGHT / BLOCK_HEIGHT);
+	bits = nullptr;
+	reference = nullptr;
+	working = nullptr;
+	epochs = nullptr;
+	level1 = nullptr;
+	level2 = nullptr;
+	bandLocks = nullptr;
+	resize(DEFAULT_BUFFER_WIDTH, DEFAULT_BUFFER_HEIGHT, DEFAULT_BLOCK_WIDTH, DEFAULT_BLOCK_HEIGHT);
+}
+
+//allocate memory starting on a cache line -- free it with freeAligned
+static void* allocAligned(size_t bytes) {
+	//the pointer that was allocated is kept just before the aligned memory
+	char* raw = (char*) ::operator new(bytes + CACHE_LINE_SIZE + sizeof(void*));
+	uintptr_t aligned = ((uintptr_t)(raw + sizeof(void*)) + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+	((void**)aligned)[-1] = raw;
+	return (void*)aligned;
+}
+
+//free memory from allocAligned
+static void freeAligned(void* p) {
+	if (p != nullptr) {
+		::operator delete(((void**)p)[-1]);
+	}
+}
+
+//allocate blocks for a buffer of this size -- see header
+void DepthBuffer::resize(uint32_t width, uint32_t height, uint32_t blockWidth, uint32_t blockHeight) {
+	freeAligned(bits);
+	freeAligned(reference);
+	freeAligned(working);
+	freeAligned(epochs);
+	delete[] level1;
+	delete[] level2;
+	delete[] bandLocks;
+
+	//round up to whole blocks -- NDC space is stretched over the whole buffer, so this only changes the pixel aspect a little
+	widthB = (width + blockWidth - 1) / blockWidth;
+	heightB = (height + blockHeight - 1) / blockHeight;
+	this->width = widthB * blockWidth;
+	this->height = heightB * blockHeight;
+	this->blockWidth = blockWidth;
+	this->blockHeight = blockHeight;
 
 	blockCount = widthB * heightB;
-	std::cout << "DepthBuffer making " << blockCount << " blocks" << std::endl;
-	arr = new Block[blockCount];
+	std::cout << "DepthBuffer making " << blockCount << " blocks of " << blockWidth << "x" << blockHeight << " pixels" << std::endl;
+	bits = allocAligned(blockCount * blockHeight * (blockWidth / 8)); //one bit per pixel
+	reference = (GLfloat*) allocAligned(blockCount * sizeof(GLfloat));
+	working = (GLfloat*) allocAligned(blockCount * sizeof(GLfloat));
+	epochs = (uint32_t*) allocAligned(blockCount * sizeof(uint32_t));
+
+	//every block is stale, so it's cleared when it's first rendered into
+	std::fill(epochs, epochs + blockCount, 0);
+	epoch = 0;
+
+	//pyramid levels round up, so blocks at the edges are covered
+	width1 = (widthB + PYRAMID_FACTOR - 1) / PYRAMID_FACTOR;
+	height1 = (heightB + PYRAMID_FACTOR - 1) / PYRAMID_FACTOR;
+	width2 = (width1 + PYRAMID_FACTOR - 1) / PYRAMID_FACTOR;
+	height2 = (height1 + PYRAMID_FACTOR - 1) / PYRAMID_FACTOR;
+	level1 = new GLfloat[width1 * height1];
+	level2 = new GLfloat[width2 * height2];
+
+	bandLocks = new std::atomic<uint32_t>[height1];
+	for (uint32_t y = 0; y < height1; y++) {
+		bandLocks[y] = 0;
+	}
+
+	reset();
 }
 
 //delete blocks
 DepthBuffer::~DepthBuffer() {
-	delete[] arr;
+	freeAligned(bits);
+	freeAligned(reference);
+	freeAligned(working);
+	freeAligned(epochs);
+	delete[] level1;
+	delete[] level2;
+	delete[] bandLocks;
 }
 
-//reset all blocks in buffer
+//reset all blocks in buffer -- see header
 void DepthBuffer::reset() {
-	for (int i = 0; i < heightB; i++) {
-		for (int j = 0; j < widthB; j++) {
-			Block& b = getBlock(j, i);
-			b.reset();
+	std::fill(reference, reference + blockCount, 1.0f);
+
+	//masks and working depths of all blocks are stale now
+	epoch++;
+	if (epoch == 0) { //wrapped around -- old epochs could match again
+		std::fill(epochs, epochs + blockCount, 0);
+		epoch = 1;
+	}
+
+	//every block has the maximum depth now
+	std::fill(level1, level1 + width1 * height1, 1.0f);
+	std::fill(level2, level2 + width2 * height2, 1.0f);
+}
+
+//recompute level 1 cells covering these blocks -- see header
+void DepthBuffer::updateLevel1(int iStart, int iEnd, int jStart, int jEnd) {
+	for (int y = iStart / PYRAMID_FACTOR; y <= iEnd / PYRAMID_FACTOR; y++) {
+		int rowEnd = std::min((y + 1) * PYRAMID_FACTOR, (int)heightB);
+		for (int x = jStart / PYRAMID_FACTOR; x <= jEnd / PYRAMID_FACTOR; x++) {
+			int colEnd = std::min((x + 1) * PYRAMID_FACTOR, (int)widthB);
+
+			GLfloat z = 0.0f;
+			for (int i = y * PYRAMID_FACTOR; i < rowEnd; i++) {
+				for (int j = x * PYRAMID_FACTOR; j < colEnd; j++) {
+					z = std::max(z, reference[i * widthB + j]);
+				}
+			}
+			level1[y * width1 + x] = z;
 		}
 	}
 }
 
-/*	get block of depth buffer
+//recompute level 2 cells covering these blocks -- see header
+void DepthBuffer::updateLevel2(int iStart, int iEnd, int jStart, int jEnd) {
+	const int blocks = PYRAMID_FACTOR * PYRAMID_FACTOR; //blocks along each side of a level 2 cell
+	for (int y = iStart / blocks; y <= iEnd / blocks; y++) {
+		int rowEnd = std::min((y + 1) * PYRAMID_FACTOR, (int)height1);
+		for (int x = jStart / blocks; x <= jEnd / blocks; x++) {
+			int colEnd = std::min((x + 1) * PYRAMID_FACTOR, (int)width1);
+
+			GLfloat z = 0.0f;
+			for (int i = y * PYRAMID_FACTOR; i < rowEnd; i++) {
+				for (int j = x * PYRAMID_FACTOR; j < colEnd; j++) {
+					z = std::max(z, level1[i * width1 + j]);
+				}
+			}
+			level2[y * width2 + x] = z;
+		}
+	}
+}
 
-	coordinates refer to blocks
+//take the lock of a row of level 1 cells -- see header
+void DepthBuffer::lockBand(int y) {
+	uint32_t unlocked = 0;
+	while (!bandLocks[y].compare_exchange_weak(unlocked, 1, std::memory_order_acquire)) {
+		unlocked = 0;
+		std::this_thread::yield(); //the thread holding it might not be running
+	}
+}
 
-	top left block is 0,0
-	block to the right of that is 1,0
-	bottom right block is (widthB - 1, heightB - 1)
-*/
-Block& DepthBuffer::getBlock(int x, int y) {
-	int index = y * widthB + x;
-	return arr[index];
+//give back the lock of a row of level 1 cells
+void DepthBuffer::unlockBand(int y) {
+	bandLocks[y].store(0, std::memory_order_release);
 }
 
-//print depth buffer masks to stdout (for visualization and debugging of depth buffer)
-void DepthBuffer::print() {
-	for (int i = 0; i < heightB; i++) {
-		for (int j = 0; j < BLOCK_HEIGHT; j++) {
-			for (int k = 0; k < widthB; k++) {
-				Block& b = getBlock(k, i);
-				printBits(b.bits[j]);
+//true if any block in this range has reference depth >= z -- see header
+bool DepthBuffer::anyReferenceAtLeast(GLfloat z, int iStart, int iEnd, int jStart, int jEnd) {
+	if (iStart > iEnd || jStart > jEnd) {
+		return false;
+	}
+
+	const int blocks = PYRAMID_FACTOR * PYRAMID_FACTOR; //blocks along each side of a level 2 cell
+	for (int y2 = iStart / blocks; y2 <= iEnd / blocks; y2++) {
+		for (int x2 = jStart / blocks; x2 <= jEnd / blocks; x2++) {
+			if (level2[y2 * width2 + x2] < z) {
+				continue; //everything in this cell is nearer than z
+			}
+
+			//level 1 cells within this level 2 cell and the range
+			int y1Start = std::max(iStart / PYRAMID_FACTOR, y2 * PYRAMID_FACTOR);
+			int y1End = std::min(iEnd / PYRAMID_FACTOR, y2 * PYRAMID_FACTOR + PYRAMID_FACTOR - 1);
+			int x1Start = std::max(jStart / PYRAMID_FACTOR, x2 * PYRAMID_FACTOR);
+			int x1End = std::min(jEnd / PYRAMID_FACTOR, x2 * PYRAMID_FACTOR + PYRAMID_FACTOR - 1);
+
+			for (int y1 = y1Start; y1 <= y1End; y1++) {
+				for (int x1 = x1Start; x1 <= x1End; x1++) {
+					if (level1[y1 * width1 + x1] < z) {
+						continue;
+					}
+
+					//blocks within this level 1 cell and the range
+					int bjStart = std::max(jStart, x1 * PYRAMID_FACTOR);
+					int bjEnd = std::min(jEnd, x1 * PYRAMID_FACTOR + PYRAMID_FACTOR - 1);
+					int biEnd = std::min(iEnd, y1 * PYRAMID_FACTOR + PYRAMID_FACTOR - 1);
+					for (int i = std::max(iStart, y1 * PYRAMID_FACTOR); i <= biEnd; i++) {
+						if (testRow(reference + i * widthB, bjStart, bjEnd, z)) {
+							return true;
+						}
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+//print masks of a buffer with blocks HEIGHT pixels high to stdout
+template<int WIDTH, int HEIGHT>
+static void printBlocks(DepthBuffer& d) {
+	for (uint32_t i = 0; i < d.heightB; i++) {
+		d.touch<WIDTH, HEIGHT>(i, 0, d.widthB - 1); //blocks nothing was rendered into still have last frame's masks
+		BlockRow<WIDTH, HEIGHT> row = d.row<WIDTH, HEIGHT>(i);
+		for (int j = 0; j < HEIGHT; j++) {
+			for (uint32_t k = 0; k < d.widthB; k++) {
+				printBits(row.bits[k * HEIGHT + j]);
 			}
 			std::cout << std::endl;
 		}
 	}
 }
 
-//True if point is inside the near plane -- (false if point is behind camera)
+//print depth buffer masks to stdout (for visualization and debugging of depth buffer)
+void DepthBuffer::print() {
+	switch (blockHeight) {
+	case 4:
+		if (blockWidth == 64) {
+			printBlocks<64, 4>(*this);
+		} else {
+			printBlocks<32, 4>(*this);
+		}
+		break;
+	case 16:
+		if (blockWidth == 64) {
+			printBlocks<64, 16>(*this);
+		} else {
+			printBlocks<32, 16>(*this);
+		}
+		break;
+	default:
+		if (blockWidth == 64) {
+			printBlocks<64, 8>(*this);
+		} else {
+			printBlocks<32, 8>(*this);
+		}
+	}
+}
+
+//True if point (in clip space) is inside the near plane -- (false if point is behind camera)
+//the near plane is where z = -w in clip space, which is z = -NEAR in camera space
 #define INSIDE(p) \
-	(p.z <= -NEAR)
+	(p.z >= -p.w)
+
+//add point to the buffer, growing it if it's full -- see header
+void TriangleBuffer::add(const glm::vec4& p, GLfloat clipW) {
+	if (count == x.size()) {
+		size_t size = std::max((size_t)768, count * 2); //256 triangles to start with
+		x.resize(size);
+		y.resize(size);
+		z.resize(size);
+		w.resize(size);
+	}
+	x[count] = p.x;
+	y[count] = p.y;
+	z[count] = p.z;
+	w[count] = clipW;
+	count++;
+}
 
-/*
-	transform raw GLfloat triangle data with respect to the model/view matrix, then
-	perform clipping with respect to the near plane, and write resultant triangles into vector of vec3s
-	after applying perspective transformation
+//transformed triangles of the occluder being rendered -- kept between objects and frames so its memory is reused
+static TriangleBuffer occluderTriangles;
 
-	clipping of a triangle may produce 0, 1, or 2 triangles
+std::vector<glm::vec3> worldPoints;
+std::vector<WorldBounds> worldBounds;
+WorldBoxes worldBoxes;
+static std::vector<uint8_t> frustumFlags; //1 for each object in worldBoxes that is inside the view frustum -- set by frustumTestAll
+static glm::mat4 viewProject; //project * view for the frame being culled -- set by startCulling
+glm::vec4 frustumPlanes[6];
 
-	data -- GLfloat data of triangles in format: x, y, z, x, y, z, x, y, z (3 points specify triangle, and those points are contiguous in this buffer)
-	tris -- where resultant triangles are written to (3 points specify triangle)
-	model -- model matrix to use for transformations
+//transform raw GLfloat data (x, y, z, x, y, z, ...) with this matrix and add it to worldPoints
+static void bakePoints(const std::vector<GLfloat>& data, const glm::mat4& world, bool mirrored) {
+	size_t start = worldPoints.size();
+	for (auto it = data.begin(); it != data.end();) {
+		GLfloat pz = *it++; //reversed -- see bakeScene
+		GLfloat py = *it++;
+		GLfloat px = *it++;
+		worldPoints.push_back(glm::vec3(world * glm::vec4(px, py, pz, 1.0f)));
+	}
 
-*/
-void transformPoints(const std::vector<GLfloat> &data, std::vector<glm::vec3> &tris, const glm::mat4 &model) {
+	//a mirrored triangle is wound the other way, so it would look like a back face from the outside -- turn it back around
+	if (mirrored) {
+		for (size_t n = start; n + 2 < worldPoints.size(); n += 3) {
+			std::swap(worldPoints[n + 1], worldPoints[n + 2]);
+		}
+	}
+}
+
+//world space corners and bounding sphere of the box around raw GLfloat data (x, y, z, x, y, z, ...) transformed with this matrix
+static WorldBounds bakeBounds(const std::vector<GLfloat>& data, const glm::mat4& world) {
+	//box in model space
+	glm::vec3 minP(std::numeric_limits<GLfloat>::max());
+	glm::vec3 maxP(std::numeric_limits<GLfloat>::lowest());
+	for (auto it = data.begin(); it != data.end();) {
+		GLfloat pz = *it++; //reversed -- see bakeScene
+		GLfloat py = *it++;
+		GLfloat px = *it++;
+		minP = glm::min(minP, glm::vec3(px, py, pz));
+		maxP = glm::max(maxP, glm::vec3(px, py, pz));
+	}
+
+	WorldBounds b;
+	glm::vec3 center(0.0f);
+	for (int k = 0; k < 8; k++) {
+		glm::vec3 corner((k & 1) ? maxP.x : minP.x, (k & 2) ? maxP.y : minP.y, (k & 4) ? maxP.z : minP.z);
+		glm::vec3 p = glm::vec3(world * glm::vec4(corner, 1.0f));
+		b.cornerX[k] = p.x;
+		b.cornerY[k] = p.y;
+		b.cornerZ[k] = p.z;
+		center += p / 8.0f;
+	}
+
+	b.center = center;
+	b.radius = 0.0f;
+	for (int k = 0; k < 8; k++) {
+		b.radius = std::max(b.radius, glm::length(glm::vec3(b.cornerX[k], b.cornerY[k], b.cornerZ[k]) - center));
+	}
+	return b;
+}
+
+//put occluder and bounding box points of objects into worldPoints -- see header
+void bakeScene(std::vector<ModelCollection>& models) {
 	/*
 		I have no idea why, but this scaling and rotation is needed, otherwise the rasterization shows a different view of the object than the GL view...
 
 		in testing, GL and the rasterizer show the same result, except for when the
 		data comes from a Model
+
+		(points used to be read with glm::vec4(*it++, *it++, *it++, 1.0f), and the compilers used evaluate those
+		arguments right to left -- the points below are read the same way, and rot and scale make up for it)
 	*/
 	glm::mat4 rot = glm::rotate(glm::mat4(), (GLfloat)-PI / 2.0f, glm::vec3(0.0f, 1.0f, 0.0f));
 	glm::mat4 scale = glm::scale(glm::mat4(), glm::vec3(1.0f, 1.0f, -1.0f));
 
-	for (auto it = data.begin(); it != data.end();) {
-		//get one triangle from the buffer
-		glm::vec4 t1(*it++, *it++, *it++, 1.0f);
-		glm::vec4 t2(*it++, *it++, *it++, 1.0f);
-		glm::vec4 t3(*it++, *it++, *it++, 1.0f);
-		
-		//transform it to camera space
-		t1 = view * model * rot * scale * t1;
-		t1 /= t1.w;
-		t2 = view * model * rot * scale * t2;
-		t2 /= t2.w;
-		t3 = view * model * rot * scale * t3;
-		t3 /= t3.w;
+	worldPoints.clear();
+	worldBounds.clear();
+	worldBoxes = WorldBoxes();
+	for (auto it = models.begin(); it != models.end(); it++) {
+		glm::mat4 world = it->modelMatrix * rot * scale;
+
+		//rot and scale (with the points read reversed) mirror every object twice, which leaves their triangles facing
+		//the same way -- only a model matrix that mirrors the object turns them around
+		bool mirrored = glm::determinant(glm::mat3(it->modelMatrix)) < 0.0f;
+
+		it->occluderStart = (uint32_t)worldPoints.size();
+		bakePoints(it->occluderData, world, mirrored);
+		it->occluderCount = (uint32_t)worldPoints.size() - it->occluderStart;
+
+		it->boundsIndex = (uint32_t)worldBounds.size();
+		worldBounds.push_back(bakeBounds(it->boxData, world));
+
+		//axis aligned box around the corners
+		const WorldBounds& b = worldBounds.back();
+		worldBoxes.minX.push_back(*std::min_element(b.cornerX, b.cornerX + 8));
+		worldBoxes.minY.push_back(*std::min_element(b.cornerY, b.cornerY + 8));
+		worldBoxes.minZ.push_back(*std::min_element(b.cornerZ, b.cornerZ + 8));
+		worldBoxes.maxX.push_back(*std::max_element(b.cornerX, b.cornerX + 8));
+		worldBoxes.maxY.push_back(*std::max_element(b.cornerY, b.cornerY + 8));
+		worldBoxes.maxZ.push_back(*std::max_element(b.cornerZ, b.cornerZ + 8));
+	}
+	frustumFlags.assign(worldBounds.size(), 1);
+
+	buildBVH(models); //also puts worldBounds and worldBoxes in the order of the hierarchy
+}
+
+//the frame whose depth buffer keepDepths keeps -- its view, and its number of blocks
+static glm::mat4 keptViewProject;
+static uint32_t keptBlockCount = 0;
+static std::vector<uint8_t> keptOccluders; //1 for each object (in the order of worldBounds) whose occluder is in the depth buffer
+static std::vector<size_t> keptPoints; //for each object, how many points of its transformed occluder are in the depth buffer
+
+static std::chrono::high_resolution_clock::time_point cullStart; //when startCulling was called
+
+//has culling this frame used up its time budget?
+static bool outOfTime() {
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - cullStart;
+	return elapsed.count() >= budgetMicroseconds;
+}
+
+//get ready to cull a frame -- see header
+void startCulling() {
+	cullStart = std::chrono::high_resolution_clock::now();
+	skippedOccluders = skippedTriangles = 0;
+
+	viewProject = project * view;
+
+	//frustum planes from the rows of the view-projection matrix -- a point is inside if -w <= x, y, z <= w in clip space
+	glm::vec4 row0(viewProject[0][0], viewProject[1][0], viewProject[2][0], viewProject[3][0]);
+	glm::vec4 row1(viewProject[0][1], viewProject[1][1], viewProject[2][1], viewProject[3][1]);
+	glm::vec4 row2(viewProject[0][2], viewProject[1][2], viewProject[2][2], viewProject[3][2]);
+	glm::vec4 row3(viewProject[0][3], viewProject[1][3], viewProject[2][3], viewProject[3][3]);
+	frustumPlanes[0] = row3 + row0; //left
+	frustumPlanes[1] = row3 - row0; //right
+	frustumPlanes[2] = row3 + row1; //bottom
+	frustumPlanes[3] = row3 - row1; //top
+	frustumPlanes[4] = row3 + row2; //near
+	frustumPlanes[5] = row3 - row2; //far
+	for (int i = 0; i < 6; i++) {
+		frustumPlanes[i] /= glm::length(glm::vec3(frustumPlanes[i]));
+	}
+
+	//a camera that hasn't moved or turned since the last frame keeps its depth buffer, and the occluders rendered into it
+	//-- otherwise the buffer starts out cleared
+	if (!keepDepths || viewProject != keptViewProject || keptBlockCount != dBuffer.blockCount || keptOccluders.size() != worldBounds.size()) {
+		dBuffer.reset();
+		if (keepDepths) {
+			keptViewProject = viewProject;
+			keptBlockCount = dBuffer.blockCount;
+			keptOccluders.assign(worldBounds.size(), 0);
+			keptPoints.assign(worldBounds.size(), 0);
+		}
+	}
+}
+
+//test all objects against the frustum at once -- see header
+void frustumTestAll() {
+	frustumTest(worldBoxes, 0, (int)frustumFlags.size(), frustumPlanes, frustumFlags.data());
+}
+
+/*	true if a triangle (after the perspective divide) might cover a pixel center of the depth buffer, and should be rasterized
+
+	triangles with no area, and triangles whose bounding rectangle has no pixel center of the buffer in it, are dropped
+	back faces (wound clockwise in NDC space, like in GL) are dropped too unless keepBackfaces is set -- the front faces
+	of a closed occluder cover everything its back faces do, and are nearer
+
+	the rectangle is widened by a bit more than the snapping in setupTriangle moves points, so this never drops a
+	triangle that covers a pixel center once it's set up
+*/
+static inline bool keepTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, bool keepBackfaces) {
+	GLfloat area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y); //twice the signed area, positive if counterclockwise
+	if (!(area > 0.0f || (keepBackfaces && area < 0.0f))) {
+		return false; //no area (or not a number), or a back face
+	}
+
+	//bounding rectangle in pixel space -- y is flipped going from NDC space
+	glm::vec2 minP(std::min(a.x, std::min(b.x, c.x)), std::max(a.y, std::max(b.y, c.y)));
+	glm::vec2 maxP(std::max(a.x, std::max(b.x, c.x)), std::min(a.y, std::min(b.y, c.y)));
+	convertVec(minP);
+	convertVec(maxP);
+
+	const GLfloat slack = 1.0f / (1 << (SUBPIXEL_BITS - 1)); //two snapping steps
+	GLfloat xStart = std::max(std::ceil(minP.x - 0.5f - slack), 0.0f);
+	GLfloat xEnd = std::min(std::floor(maxP.x - 0.5f + slack), (GLfloat)dBuffer.width - 1.0f);
+	GLfloat yStart = std::max(std::ceil(minP.y - 0.5f - slack), 0.0f);
+	GLfloat yEnd = std::min(std::floor(maxP.y - 0.5f + slack), (GLfloat)dBuffer.height - 1.0f);
+	return xStart <= xEnd && yStart <= yEnd;
+}
+
+//bits of the side planes of a frustum that a point in clip space is outside of -- the frustum is sx and sy times
+//wider and taller than the view frustum
+static inline int outcode(const glm::vec4& p, GLfloat sx, GLfloat sy) {
+	return (p.x > sx * p.w ? 1 : 0) | (p.x < -sx * p.w ? 2 : 0) | (p.y > sy * p.w ? 4 : 0) | (p.y < -sy * p.w ? 8 : 0);
+}
+
+/*	clip a convex polygon in clip space with a plane, keeping the part where dot(plane, p) >= 0
+
+	this is one step of the Sutherland-Hodgman clipping algorithm -- in has count points, and out gets at most
+	count + 1 of them (or none if all of the polygon is clipped away)
+
+	returns the number of points written to out
+*/
+static int clipPolygon(const glm::vec4* in, int count, const glm::vec4& plane, glm::vec4* out) {
+	int outCount = 0;
+	for (int k = 0; k < count; k++) { //for each line (edges are in[k]-in[k + 1])
+		const glm::vec4& s = in[k];
+		const glm::vec4& p = in[(k + 1) % count];
+		GLfloat ds = glm::dot(plane, s);
+		GLfloat dp = glm::dot(plane, p);
+
+		if (ds >= 0.0f && dp >= 0.0f) {
+			//both inside -- output p
+			out[outCount++] = p;
+		}
+		else if (ds >= 0.0f) {
+			//p outside -- clip p with respect to the plane and output result
+			out[outCount++] = s + (p - s) * (ds / (ds - dp));
+		}
+		else if (dp >= 0.0f) {
+			//outside to inside -- clip s and output i and p
+			out[outCount++] = s + (p - s) * (ds / (ds - dp));
+			out[outCount++] = p;
+		}
+		//both outside -- reject both
+	}
+	return outCount;
+}
+
+/*
+	transform triangles from world space into clip space with the view-projection matrix, then
+	perform clipping with respect to the near plane and the guard band, and write resultant triangles into a
+	TriangleBuffer after the perspective divide
+
+	triangles entirely outside one of the side planes of the view frustum are rejected before any clipping, and
+	triangles reaching outside the guard band (GUARD_BAND times the size of the view frustum) are clipped to it, so
+	no point ends up far away from the depth buffer -- clipping of a triangle may produce up to 6 triangles, and
+	triangles that can't cover a pixel center are left out (see keepTriangle)
+
+	points -- world space points of triangles (3 points specify triangle), usually part of worldPoints
+	count -- number of points
+	tris -- where resultant triangles are written to (3 points specify triangle) -- it is cleared first
+	keepBackfaces -- keep triangles facing away from the camera, for occluders that aren't closed -- they're also
+		kept once a triangle is found crossing the near plane
+
+	nothing is allocated unless tris needs to grow
+*/
+void transformPoints(const glm::vec3* points, size_t count, TriangleBuffer &tris, bool keepBackfaces) {
+	//the near plane is where z = -w in clip space, and the guard band planes are where x or y = +-GUARD_BAND * w
+	static const glm::vec4 nearPlane(0.0f, 0.0f, 1.0f, 1.0f);
+	static const glm::vec4 guardPlanes[4] = {
+		glm::vec4(-1.0f, 0.0f, 0.0f, (GLfloat)GUARD_BAND), //right
+		glm::vec4(1.0f, 0.0f, 0.0f, (GLfloat)GUARD_BAND), //left
+		glm::vec4(0.0f, -1.0f, 0.0f, (GLfloat)GUARD_BAND), //top
+		glm::vec4(0.0f, 1.0f, 0.0f, (GLfloat)GUARD_BAND) //bottom
+	};
+
+	//the last column and row of pixels have their centers a bit past the edge of NDC space (see convertVec), so
+	//triangles are only rejected once they're a bit further out than that
+	const GLfloat sideX = 1.0f + 2.0f / (GLfloat)(dBuffer.width - 1);
+	const GLfloat sideY = 1.0f + 2.0f / (GLfloat)(dBuffer.height - 1);
+
+	tris.clear();
+	for (size_t n = 0; n + 2 < count; n += 3) {
+		//transform one triangle into clip space -- this is the only matrix multiply per point
+		glm::vec4 t[3];
+		for (int k = 0; k < 3; k++) {
+			t[k] = viewProject * glm::vec4(points[n + k], 1.0f);
+		}
+
+		//all points outside the same side plane -- the triangle can't be seen (this holds even for points behind the camera)
+		if ((outcode(t[0], sideX, sideY) & outcode(t[1], sideX, sideY) & outcode(t[2], sideX, sideY)) != 0) {
+			continue;
+		}
+
+		//the near plane cuts the mesh open, so its back faces can be seen through the cut -- start over keeping them
+		if (!keepBackfaces && !(INSIDE(t[0]) && INSIDE(t[1]) && INSIDE(t[2]))) {
+			transformPoints(points, count, tris, true);
+			return;
+		}
 
 		//now perform clipping with the near plane
-		std::vector<glm::vec4*> points;
-		std::vector<glm::vec4> face; //face resultant from clipping (can be empty, or be a triangle, or a square)
-		points.push_back(&t1);
-		points.push_back(&t2);
-		points.push_back(&t3);
-
-		std::vector<std::pair<glm::vec4*, glm::vec4*>> pairs; //pairs representing triangle edges
-		pairs.push_back(std::pair<glm::vec4*, glm::vec4*>(points[0], points[1]));
-		pairs.push_back(std::pair<glm::vec4*, glm::vec4*>(points[1], points[2]));
-		pairs.push_back(std::pair<glm::vec4*, glm::vec4*>(points[2], points[0]));
-
-		//for each line
-		for (auto it = pairs.begin(); it != pairs.end(); it++) {
-			glm::vec4& s = (*it->first);
-			glm::vec4& p = (*it->second);
-
-			//This is the Sutherland-Hodgman clipping algorithm
-			if (INSIDE(s) && INSIDE(p)) {
-				//both inside -- output p
-				face.push_back(p);
-			}
-			else if (INSIDE(s) && !INSIDE(p)) {
-				//p outside -- clip p with respect to near plane and output result
-				GLfloat a = (-NEAR - s.z) / (p.z - s.z);
-				glm::vec4 i = s + (p - s) * a;
-				face.push_back(i);
-			}
-			else if (!INSIDE(s) && !INSIDE(p)) {
-				//both outside -- reject both
-				continue;
-			}
-			else if (!INSIDE(s) && INSIDE(p)) {
-				//outside to inside -- clip s and output i and p
-				GLfloat a = (-NEAR - s.z) / (p.z - s.z);
-				glm::vec4 i = s + (p - s) * a;
-				face.push_back(i);
-				face.push_back(p);
+		glm::vec4 face[8]; //face resultant from clipping (can be empty, or be a polygon of up to 8 points)
+		glm::vec4 clipped[8];
+		int faceSize = clipPolygon(t, 3, nearPlane, face);
+
+		//then with the guard band planes the face reaches past
+		int outside = 0;
+		for (int k = 0; k < faceSize; k++) {
+			outside |= outcode(face[k], (GLfloat)GUARD_BAND, (GLfloat)GUARD_BAND);
+		}
+		for (int b = 0; b < 4; b++) {
+			if (outside & (1 << b)) {
+				faceSize = clipPolygon(face, faceSize, guardPlanes[b], clipped);
+				std::copy(clipped, clipped + faceSize, face);
 			}
 		}
 
-		//project resulting face's points
-		for (auto it = face.begin(); it != face.end(); it++) {
-			(*it) = project * (*it);
-			(*it) /= it->w;
+		//perspective divide of resulting face's points
+		GLfloat clipW[8];
+		for (int k = 0; k < faceSize; k++) {
+			clipW[k] = face[k].w;
+			face[k] /= face[k].w;
 		}
 
 		//turn face into triangles
-		for (int i = 1; i + 1 < face.size(); i += 1) {
-			glm::vec4& p1 = face[0];
-			glm::vec4& p2 = face[i];
-			glm::vec4& p3 = face[i + 1];
-
-			tris.push_back(glm::vec3(p1));
-			tris.push_back(glm::vec3(p2));
-			tris.push_back(glm::vec3(p3));
+		for (int k = 1; k + 1 < faceSize; k++) {
+			if (!keepTriangle(face[0], face[k], face[k + 1], keepBackfaces)) {
+				continue;
+			}
+			tris.add(face[0], clipW[0]);
+			tris.add(face[k], clipW[k]);
+			tris.add(face[k + 1], clipW[k + 1]);
 		}
 	}
 }
 
-/*		given an object, find its bounding box in NDC coordinates (after projection transformation)
-
-*/
-void transformBoundingBox(const ModelCollection &m, GLfloat &minX, GLfloat &maxX, GLfloat &minY, GLfloat &maxY, GLfloat &minZ, GLfloat &maxZ) {
-	//transform and clip bounding box with respect to near plane
-	std::vector<glm::vec3> tris;
-	transformPoints(m.boxData, tris, m.modelMatrix);
-
-	//Defaults
-	minX = std::numeric_limits<GLfloat>::max();
-	maxX = std::numeric_limits<GLfloat>::min();
+//true if object is inside the view frustum -- see header
+bool inFrustum(const ModelCollection& m) {
+	return frustumFlags[m.boundsIndex] != 0;
+}
 
-	minY = std::numeric_limits<GLfloat>::max();
-	maxY = std::numeric_limits<GLfloat>::min();
+//test boxes against the frustum planes -- see simd.h for details
+void frustumTestScalar(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside) {
+	for (int i = start; i < end; i++) {
+		inside[i] = 1;
+		for (int k = 0; k < 6; k++) {
+			const glm::vec4& n = planes[k];
+
+			//corner of the box farthest along the plane normal -- if it's outside, the whole box is
+			GLfloat px = n.x > 0.0f ? boxes.maxX[i] : boxes.minX[i];
+			GLfloat py = n.y > 0.0f ? boxes.maxY[i] : boxes.minY[i];
+			GLfloat pz = n.z > 0.0f ? boxes.maxZ[i] : boxes.minZ[i];
+			if (((n.x * px + n.y * py) + n.z * pz) + n.w < 0.0f) {
+				inside[i] = 0;
+				break;
+			}
+		}
+	}
+}
 
-	minZ = std::numeric_limits<GLfloat>::max();
-	maxZ = std::numeric_limits<GLfloat>::min();
+//true if the sphere is at least partly inside the view frustum
+static bool sphereInFrustum(const glm::vec3& center, GLfloat radius) {
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(frustumPlanes[i]), center) + frustumPlanes[i].w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	//get min/max for each point
-	for (auto it = tris.begin(); it != tris.end(); it++) {
-		glm::vec3& p = *it;
+//project corners of a bounding box into NDC space -- see simd.h for details
+bool projectBoxScalar(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ) {
+	minX = minY = minZ = std::numeric_limits<GLfloat>::max();
+	maxX = maxY = maxZ = std::numeric_limits<GLfloat>::lowest();
+	for (int k = 0; k < 8; k++) {
+		glm::vec4 p = m * glm::vec4(b.cornerX[k], b.cornerY[k], b.cornerZ[k], 1.0f);
+		if (p.z < -p.w) {
+			return false; //corner is behind the near plane
+		}
+		p /= p.w;
 
 		minX = std::min(minX, p.x);
 		maxX = std::max(maxX, p.x);
@@ -340,24 +810,52 @@ void transformBoundingBox(const ModelCollection &m, GLfloat &minX, GLfloat &maxX
 		minZ = std::min(minZ, p.z);
 		maxZ = std::max(maxZ, p.z);
 	}
+	return true;
+}
 
-	/* don't clamp -- allow invalid ranges
-	//clamp these results to be within [-1,1]
-	minX = std::max(minX, -1.0f);
-	maxX = std::min(maxX, 1.0f);
+/*	true if any pixel in columns xStart..xEnd and rows yStart..yEnd might be at least minZ deep -- see preciseTest
 
-	minY = std::max(minY, -1.0f);
-	maxY = std::min(maxY, 1.0f);
+	a pixel is at most as deep as the reference depth of its block, and if its bit is set, also at most as deep as the
+	working depth -- so in a block with reference >= minZ, the box is still hidden if the working depth is nearer and
+	all of its pixels in the block have their bits set
+*/
+template<int WIDTH, int HEIGHT>
+static bool pixelsVisible(int xStart, int xEnd, int yStart, int yEnd, GLfloat minZ) {
+	typedef BlockMask<WIDTH> Mask;
+	const Mask full = ~(Mask)0;
+	for (int i = yStart / HEIGHT; i <= yEnd / HEIGHT; i++) { //iterate over height
+		BlockRow<WIDTH, HEIGHT> row = dBuffer.row<WIDTH, HEIGHT>(i);
+		int kStart = std::max(yStart - i * HEIGHT, 0); //scanlines of the box in this row
+		int kEnd = std::min(yEnd - i * HEIGHT, HEIGHT - 1);
+		for (int j = xStart / WIDTH; j <= xEnd / WIDTH; j++) { //iterate over width
+			if (row.reference[j] < minZ) {
+				continue; //every pixel of the block is nearer than the box
+			}
 
-	minZ = std::max(minZ, -1.0f);
-	maxZ = std::min(maxZ, 1.0f);
-	*/
-}
+			//the masks and working depth of a block nobody rendered into this frame are stale (see touch)
+			if (dBuffer.epochs[i * dBuffer.widthB + j] != dBuffer.epoch || row.working[j] >= minZ) {
+				return true;
+			}
 
+			//pixels of the box in this block -- one of them with its bit clear is only covered by the reference layer
+			int a = std::max(xStart - j * WIDTH, 0);
+			int b = std::min(xEnd - j * WIDTH, WIDTH - 1);
+			Mask box = (full >> a) & ~(b + 1 < WIDTH ? full >> (b + 1) : 0);
+			const Mask* bits = row.bits + j * HEIGHT;
+			for (int k = kStart; k <= kEnd; k++) {
+				if ((box & ~bits[k]) != 0) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
 
 //implements depth test as described by the Hasselgren et al. paper
-//given bounding box of object in NDC space (after applying transformBoundingBox), return true if box is visible according to depth buffer
-bool depthTest(GLfloat minX, GLfloat maxX, GLfloat minY, GLfloat maxY, GLfloat minZ, GLfloat maxZ) {
+//given the bounding rectangle and nearest depth of an object's box in NDC space (from projectBox), return true if box is visible according to depth buffer
+template<int WIDTH, int HEIGHT>
+static bool depthTest(GLfloat minX, GLfloat maxX, GLfloat minY, GLfloat maxY, GLfloat minZ) {
 	//bounding rectangle points
 	glm::vec2 minP(minX, minY);
 	glm::vec2 maxP(maxX, maxY);
@@ -374,190 +872,709 @@ bool depthTest(GLfloat minX, GLfloat maxX, GLfloat minY, GLfloat maxY, GLfloat m
 	maxY = minP.y;
 
 	//block coordinates of blocks possibly overlapping the bounding box
-	int iStart = std::max(((int)minY) / BLOCK_HEIGHT, 0);
-	int iEnd = std::min((int)ceil(maxY / (GLfloat) BLOCK_HEIGHT), (int)dBuffer.heightB - 1);
+	int iStart = std::max(((int)minY) / HEIGHT, 0);
+	int iEnd = std::min((int)ceil(maxY / (GLfloat) HEIGHT), (int)dBuffer.heightB - 1);
 
-	int jStart = std::max(((int)minX) / 32, 0); 
-	int jEnd = std::min((int)ceil(maxX / 32.0f), (int)dBuffer.widthB - 1);
+	int jStart = std::max(((int)minX) / WIDTH, 0); 
+	int jEnd = std::min((int)ceil(maxX / (GLfloat) WIDTH), (int)dBuffer.widthB - 1);
 
-	for (int i = iStart; i <= iEnd; i++) { //iterate over height
-		for (int j = jStart; j <= jEnd; j++) { //iterate over width
-			Block& b = dBuffer.getBlock(j, i);
+	//bounding box might be visible if any block has a reference depth >= minZ -- so object is considered visible
+	if (!dBuffer.anyReferenceAtLeast(minZ, iStart, iEnd, jStart, jEnd)) {
+		return false;
+	}
+	if (!preciseTest) {
+		return true;
+	}
 
-			if (b.reference >= minZ) {
-				return true; //bounding box might be visible in this block -- so object is considered visible
-			}
+	//pixels the bounding box overlaps
+	int xStart = std::max((int)std::floor(minX), 0);
+	int xEnd = std::min((int)std::floor(maxX), (int)dBuffer.width - 1);
+	int yStart = std::max((int)std::floor(minY), 0);
+	int yEnd = std::min((int)std::floor(maxY), (int)dBuffer.height - 1);
+	return pixelsVisible<WIDTH, HEIGHT>(xStart, xEnd, yStart, yEnd, minZ);
+}
+
+//true if any block of the row has reference >= minZ -- see simd.h for details
+bool testRowScalar(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ) {
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		if (reference[j] >= minZ) {
+			return true; //bounding box might be visible in this block
 		}
 	}
 	return false;
 }
 
-/*	given triangle points in NDC space, render triangle into depth buffer and update depths as needed
+//rasterize triangle into a row of blocks and update their depths -- see simd.h for details
+template<int WIDTH, int HEIGHT>
+bool renderRowScalar(BlockRow<WIDTH, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	typedef BlockMask<WIDTH> Mask;
+	const Mask full = ~(Mask)0; //mask of a full scanline
+
+	//edge flip masks as wide as a scanline
+	const Mask mask1 = o1 ? full : 0;
+	const Mask mask2 = o2 ? full : 0;
+	const Mask mask3 = o3 ? full : 0;
+
+	bool updated = false; //was any reference depth updated?
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		Mask* bits = row.bits + j * HEIGHT; //masks of this block
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = std::min(maxZStart, maxZ); //depth of triangle within this block
+		maxZStart += maxZStep; //added up block by block, so every kernel gets the same depths
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block (tri.zMin > tile.zMax0 in the paper)
+		}
+
+		////////////////////////////This section is the depth buffer update from the Hasselgren et al. paper
+		//blockMaxZ is the tri.zMax in the paper, tile.zMax0 is reference, tile.zMax1 is working
+
+		//heuristic to throw away working layer -- this is used in the paper to help prevent objects
+		//in the background from leaking into the foreground
+		GLfloat dist1t = working - blockMaxZ;
+		GLfloat dist01 = reference - working;
+		if (dist1t > dist01) {
+			working = 0.0f;
+			for (int k = 0; k < HEIGHT; k++) {
+				bits[k] = 0;
+			}
+		}
+
+		//merge triangle into working layer
+		working = std::max(working, blockMaxZ); //this might move the working layer deeper -- and is why the heuristic above is used
+		for (int k = 0; k < HEIGHT; k++) {
+			//x coordinates of events relative to this block and scanline
+			uint32_t e1 = std::max(0, e1x[k] - j * WIDTH);
+			uint32_t e2 = std::max(0, e2x[k] - j * WIDTH);
+			uint32_t e3 = std::max(0, e3x[k] - j * WIDTH);
 
-	maxZ is z of triangle
+			Mask result = line(e1, e2, e3, mask1, mask2, mask3);
+			bits[k] |= result;
+		}
+
+		//update reference layer if mask is full
+		bool blockFull = true;
+		for (int k = 0; k < HEIGHT; k++) {
+			blockFull = (blockFull && bits[k] == full);
+		}
+		if (blockFull) {
+			reference = std::min(reference, working); //I use the min instead of just assigning reference as in the paper -- this produces slightly better results
+			working = 0.0f;
+			updated = true;
+			for (int k = 0; k < HEIGHT; k++) {
+				bits[k] = 0;
+			}
+		}
+		/////////////////////////////////////
+	}
+	return updated;
+}
+
+//the scalar render kernel is used by simd.cpp for every block size
+template bool renderRowScalar<32, 4>(BlockRow<32, 4>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowScalar<32, 8>(BlockRow<32, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowScalar<32, 16>(BlockRow<32, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowScalar<64, 4>(BlockRow<64, 4>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowScalar<64, 8>(BlockRow<64, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowScalar<64, 16>(BlockRow<64, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+
+//compute everything needed to rasterize a triangle -- see header for details
+void setupTriangle(glm::vec3 v1, glm::vec3 v2, glm::vec3 v3, TriangleSetup& t) {
+	t.minZ = std::min(v1.z, std::min(v2.z, v3.z));
+	t.maxZ = std::max(v1.z, std::max(v2.z, v3.z));
+
+	//covers nothing until shown otherwise
+	t.iStart = t.jStart = 0;
+	t.iEnd = t.jEnd = -1;
+
+	//points in pixel space
+	glm::vec2 t1(v1);
+	glm::vec2 t2(v2);
+	glm::vec2 t3(v3);
+	convertVec(t1);
+	convertVec(t2);
+	convertVec(t3);
+	GLfloat range = (GLfloat)FIXED_RANGE;
+	if (!(std::fabs(t1.x) <= range && std::fabs(t1.y) <= range && std::fabs(t2.x) <= range && std::fabs(t2.y) <= range
+		&& std::fabs(t3.x) <= range && std::fabs(t3.y) <= range)) {
+		return; //too far out to be set up exactly (or not a number)
+	}
+
+	//depth plane through the points -- depth is linear in NDC space, and so in pixel space
+	//a triangle too thin to work it out for just uses maxZ everywhere
+	double ux = (double)t2.x - t1.x, uy = (double)t2.y - t1.y, uz = (double)v2.z - v1.z;
+	double vx = (double)t3.x - t1.x, vy = (double)t3.y - t1.y, vz = (double)v3.z - v1.z;
+	double area = ux * vy - vx * uy;
+	if (area != 0.0) {
+		t.zx = (uz * vy - vz * uy) / area;
+		t.zy = (ux * vz - vx * uz) / area;
+		t.z0 = v1.z - t.zx * t1.x - t.zy * t1.y;
+	} else {
+		t.zx = t.zy = 0.0;
+		t.z0 = t.maxZ;
+	}
+
+	//snap points to fixed point
+	const double one = (double)(1 << SUBPIXEL_BITS);
+	FixedPoint p1 = { (int64_t)std::floor(t1.x * one + 0.5), (int64_t)std::floor(t1.y * one + 0.5) };
+	FixedPoint p2 = { (int64_t)std::floor(t2.x * one + 0.5), (int64_t)std::floor(t2.y * one + 0.5) };
+	FixedPoint p3 = { (int64_t)std::floor(t3.x * one + 0.5), (int64_t)std::floor(t3.y * one + 0.5) };
+
+	//sort points from top to bottom (increasing y in pixel space)
+	sortPair(p1, p2);
+	sortPair(p2, p3);
+	sortPair(p1, p2);
+
+	//which side of the long edge (top to bottom) the middle point is on -- 0 if the triangle has no area
+	int64_t cross = (p2.x - p1.x) * (p3.y - p1.y) - (p3.x - p1.x) * (p2.y - p1.y);
+	if (cross == 0) {
+		return;
+	}
+
+	//the triangle is right of the long edge and left of the other two if the middle point is right of the long edge,
+	//and the other way around if not -- horizontal edges are always full (see setupEdge)
+	bool middleRight = cross > 0;
+	t.mask1 = middleRight && p1.y != p2.y ? ~0 : 0;
+	t.mask2 = middleRight ? 0 : ~0;
+	t.mask3 = middleRight && p2.y != p3.y ? ~0 : 0;
+	setupEdge(p1, p2, t.edge1);
+	setupEdge(p1, p3, t.edge2);
+	setupEdge(p2, p3, t.edge3);
+
+	//scanlines and columns of pixels with their centers in the bounding rectangle -- the rectangle's top
+	//and left sides are included, the bottom and right ones aren't
+	const int64_t unit = 1 << SUBPIXEL_BITS;
+	const int64_t half = unit >> 1;
+	int64_t minX = std::min(p1.x, std::min(p2.x, p3.x));
+	int64_t maxX = std::max(p1.x, std::max(p2.x, p3.x));
+	int64_t yStart = std::max(ceilDiv(p1.y - half, unit), (int64_t)0);
+	int64_t yEnd = std::min(ceilDiv(p3.y - half, unit) - 1, (int64_t)dBuffer.height - 1);
+	int64_t xStart = std::max(ceilDiv(minX - half, unit), (int64_t)0);
+	int64_t xEnd = std::min(ceilDiv(maxX - half, unit) - 1, (int64_t)dBuffer.width - 1);
+	if (yStart > yEnd || xStart > xEnd) {
+		return;
+	}
+	t.yStart = (int)yStart;
+	t.yEnd = (int)yEnd;
+
+	//blocks possibly overlapping triangle
+	t.iStart = t.yStart / (int)dBuffer.blockHeight;
+	t.iEnd = t.yEnd / (int)dBuffer.blockHeight;
+	t.jStart = (int)xStart / (int)dBuffer.blockWidth;
+	t.jEnd = (int)xEnd / (int)dBuffer.blockWidth;
+}
+
+/*	update blocks jStart..jEnd of a row that a triangle covers entirely -- returns true if any reference depth was updated
+
+	this is what the render kernels do for a block whose masks all end up full, without making the masks: the working
+	layer is merged with the triangle (and maybe thrown away first, as in the kernels), then it becomes the reference
 */
-void renderIntoDepthBuffer(glm::vec2 t1, glm::vec2 t2, glm::vec2 t3, GLfloat maxZ) {
-	fixTriangle(t1, t2, t3); //ensure points have different heights (to ensure downward facing edges can be made, and slopes are not infinite)
-
-	//centroid
-	GLfloat cx = (t1.x + t2.x + t3.x) / 3.0f;
-	GLfloat cy = (t1.y + t2.y + t3.y) / 3.0f;
-	glm::vec2 center(cx, cy);
-
-	//sort points in order of decreasing height
-	std::vector<glm::vec2*> ps;
-	ps.push_back(&t1);
-	ps.push_back(&t2);
-	ps.push_back(&t3);
-	std::sort(ps.begin(), ps.end(), triComp);
-
-	glm::vec2& p1 = *ps[0];
-	glm::vec2& p2 = *ps[1];
-	glm::vec2& p3 = *ps[2];
-
-	//downward-facing edge vectors
-	glm::vec2 l1 = p2 - p1;
-	glm::vec2 l2 = p3 - p1;
-	glm::vec2 l3 = p3 - p2;
-
-	//left-facing normals (because of the downward facing edges)
-	glm::vec2 n1(l1.y, -l1.x);
-	glm::vec2 n2(l2.y, -l2.x);
-	glm::vec2 n3(l3.y, -l3.x);
-
-	//true if left is outside
-	bool o1 = glm::dot(n1, (center - p1)) < 0; //this is the point in triangle test, but instead of inward facing normals we use left facing normals
-	bool o2 = glm::dot(n2, (center - p1)) < 0;
-	bool o3 = glm::dot(n3, (center - p2)) < 0;
-	uint32_t mask1 = o1 ? 0 : ~0;
-	uint32_t mask2 = o2 ? 0 : ~0;
-	uint32_t mask3 = o3 ? 0 : ~0;
-
-	//extrapolate edges to top of the screen in NDC space (y = 1.0)
-	glm::vec2 f1 = p1 + ((1.0f - p1.y) / l1.y) * l1;
-	glm::vec2 f2 = p1 + ((1.0f - p1.y) / l2.y) * l2;
-	glm::vec2 f3 = p2 + ((1.0f - p2.y) / l3.y) * l3;
-
-	//convert extrapolated points, and triangle points, into pixel space
-	convertVec(f1);
-	convertVec(f2);
-	convertVec(f3);
-	convertVec(p1);
-	convertVec(p2);
-	convertVec(p3);
-
-	//recompute lines in pixel space
-	l1 = p2 - p1;
-	l2 = p3 - p1;
-	l3 = p3 - p2;
-	// dx/dy slopes of triangle edges
-	GLfloat s1 = l1.x / l1.y;
-	GLfloat s2 = l2.x / l2.y;
-	GLfloat s3 = l3.x / l3.y;
-
-
-	//Find coordinates of blocks possibly overlapping triangle
-	GLfloat minY = std::min(p1.y, std::min(p2.y, p3.y));
-	GLfloat maxY = std::max(p1.y, std::max(p2.y, p3.y));
-	GLfloat minX = std::min(p1.x, std::min(p2.x, p3.x));
-	GLfloat maxX = std::max(p1.x, std::max(p2.x, p3.x));
-
-	int iStart = std::max(((int)minY) / BLOCK_HEIGHT, 0);
-	int iEnd = std::min(((int)maxY) / BLOCK_HEIGHT, (int)dBuffer.heightB - 1);
-
-	int jStart = std::max(((int)minX) / 32, 0);
-	int jEnd = std::min(((int)maxX) / 32, (int)dBuffer.widthB - 1);
+template<int WIDTH, int HEIGHT>
+static bool renderFullBlocks(BlockRow<WIDTH, HEIGHT> row, int jStart, int jEnd, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	bool updated = false;
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = std::min(maxZStart, maxZ); //depth of triangle within this block, as in the kernels
+		maxZStart += maxZStep;
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block
+		}
 
+		bool discard = working - blockMaxZ > reference - working; //same heuristic as the kernels
+		GLfloat merged = std::max(discard ? 0.0f : working, blockMaxZ);
+		reference = std::min(reference, merged);
+		working = 0.0f;
+		updated = true;
+		BlockMask<WIDTH>* bits = row.bits + j * HEIGHT;
+		for (int k = 0; k < HEIGHT; k++) {
+			bits[k] = 0;
+		}
+	}
+	return updated;
+}
 
-	for (int i = iStart; i <= iEnd; i++) { //iterate over height
-		int scanBase = i * BLOCK_HEIGHT; //height of top scanline within this block in pixel space
+/*	rasterize rows iStart..iEnd, columns jStart..jEnd of a set up triangle -- returns true if any reference depth was updated
 
-		//x coordinates of events for each scanline/triangle edge in pixel space
-		GLfloat e1f[BLOCK_HEIGHT];
-		GLfloat e2f[BLOCK_HEIGHT];
-		GLfloat e3f[BLOCK_HEIGHT];
+	e1x, e2x, e3x -- events of each edge, starting at the top scanline of row iStart
+	coverage -- blocks of each row the triangle touches, starting at row iStart (see RowCoverage)
 
-		e1f[0] = f1.x + (GLfloat)scanBase * s1;
-		e2f[0] = f2.x + (GLfloat)scanBase * s2;
-		e3f[0] = f3.x + (GLfloat)scanBase * s3;
+	blocks the triangle misses are skipped, and blocks it covers entirely are updated without making their masks,
+	so the kernels only see the blocks along its edges
+*/
+template<int WIDTH, int HEIGHT>
+static bool renderRows(const TriangleSetup& t, int iStart, int iEnd, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, const RowCoverage* coverage) {
+	bool updated = false;
+	for (int i = iStart; i <= iEnd; i++) { //iterate over height
+		const RowCoverage& c = coverage[i - iStart];
+		int first = std::max(jStart, c.first);
+		int last = std::min(jEnd, c.last);
+		if (first > last) {
+			continue; //triangle misses this row within the columns
+		}
+		int fullStart = std::max(first, c.fullStart);
+		int fullEnd = std::min(last, c.fullEnd);
+
+		int r = (i - iStart) * HEIGHT; //first scanline of this row in the events
+		dBuffer.touch<WIDTH, HEIGHT>(i, first, last); //clear blocks this is the first triangle in this frame for
+		BlockRow<WIDTH, HEIGHT> row = dBuffer.row<WIDTH, HEIGHT>(i);
+		RowDepths<WIDTH, HEIGHT> depths;
+		depths.start(t, i);
+		GLfloat zStart, zStep;
+		if (fullStart > fullEnd) {
+			depths.run(first, last, zStart, zStep);
+			updated = Kernels<WIDTH, HEIGHT>::renderRow(row, first, last, e1x + r, e2x + r, e3x + r, t.mask1, t.mask2, t.mask3, t.minZ, t.maxZ, zStart, zStep) || updated;
+			continue;
+		}
+
+		//partly covered blocks left of the covered ones, the covered ones, and partly covered ones right of them
+		if (first < fullStart) {
+			depths.run(first, fullStart - 1, zStart, zStep);
+			updated = Kernels<WIDTH, HEIGHT>::renderRow(row, first, fullStart - 1, e1x + r, e2x + r, e3x + r, t.mask1, t.mask2, t.mask3, t.minZ, t.maxZ, zStart, zStep) || updated;
+		}
+		depths.run(fullStart, fullEnd, zStart, zStep);
+		updated = renderFullBlocks<WIDTH, HEIGHT>(row, fullStart, fullEnd, t.minZ, t.maxZ, zStart, zStep) || updated;
+		if (fullEnd < last) {
+			depths.run(fullEnd + 1, last, zStart, zStep);
+			updated = Kernels<WIDTH, HEIGHT>::renderRow(row, fullEnd + 1, last, e1x + r, e2x + r, e3x + r, t.mask1, t.mask2, t.mask3, t.minZ, t.maxZ, zStart, zStep) || updated;
+		}
+	}
+	return updated;
+}
 
-		for (int r = 1; r < BLOCK_HEIGHT; r++) {
-			e1f[r] = e1f[r - 1] + s1;
-			e2f[r] = e2f[r - 1] + s2;
-			e3f[r] = e3f[r - 1] + s3;
+//rasterize part of a set up triangle into the depth buffer -- see header for details
+template<int WIDTH, int HEIGHT>
+bool renderTriangle(const TriangleSetup& t, int iStart, int iEnd, int jStart, int jEnd, bool shared) {
+	bool updated = false;
+
+	//events for each scanline/triangle edge of a band
+	int32_t e1x[PYRAMID_FACTOR * HEIGHT];
+	int32_t e2x[PYRAMID_FACTOR * HEIGHT];
+	int32_t e3x[PYRAMID_FACTOR * HEIGHT];
+	RowCoverage coverage[PYRAMID_FACTOR]; //blocks touched in each row of a band
+	TriangleWalk walk;
+
+	//go through bands of blocks one level 1 cell high
+	for (int y = iStart / PYRAMID_FACTOR; y <= iEnd / PYRAMID_FACTOR; y++) {
+		int bandStart = std::max(iStart, y * PYRAMID_FACTOR);
+		int bandEnd = std::min(iEnd, y * PYRAMID_FACTOR + PYRAMID_FACTOR - 1);
+		bool bandUpdated = false;
+		bool haveEvents = false; //events are only worked out for bands with something to render
+		if (shared) {
+			dBuffer.lockBand(y); //its level 1 cells are read below, so the lock is needed before anything else
 		}
 
-		for (int j = jStart; j <= jEnd; j++) { //iterate over width
-			Block& b = dBuffer.getBlock(j, i);
-
-			////////////////////////////This section is the depth buffer update from the Hasselgren et al. paper
-			//zMax is the tri.maxZ in the paper, tile.zMax0 is b.reference, tile.zMax1 is b.working
-
-			//heuristic to throw away working layer -- this is used in the paper to help prevent objects
-			//in the background from leaking into the foreground
-			GLfloat dist1t = b.working - maxZ;
-			GLfloat dist01 = b.reference - b.working;
-			if (dist1t > dist01) {
-				b.working = 0.0f;
-				for (int i = 0; i < BLOCK_HEIGHT; i++) {
-					b.bits[i] = 0;
+		//render runs of neighbouring level 1 cells that the triangle isn't entirely behind
+		//the kernels skip these blocks anyway, this only saves looking at them
+		int x = jStart / PYRAMID_FACTOR;
+		int xEnd = jEnd / PYRAMID_FACTOR;
+		while (x <= xEnd) {
+			if (dBuffer.level1[y * dBuffer.width1 + x] < t.minZ) {
+				x++;
+				continue;
+			}
+			int runStart = x;
+			while (x + 1 <= xEnd && dBuffer.level1[y * dBuffer.width1 + x + 1] >= t.minZ) {
+				x++;
+			}
+			int runEnd = x;
+			x++;
+
+			if (!haveEvents) {
+				if (walk.y != bandStart * HEIGHT) {
+					walk.start(t, bandStart * HEIGHT); //otherwise this band carries on from the one before
+				}
+				walk.events(t, (bandEnd - bandStart + 1) * HEIGHT, e1x, e2x, e3x);
+				for (int i = bandStart; i <= bandEnd; i++) {
+					int r = (i - bandStart) * HEIGHT;
+					coverage[i - bandStart].classify<WIDTH, HEIGHT>(t, i * HEIGHT, e1x + r, e2x + r, e3x + r);
 				}
+				haveEvents = true;
 			}
+			bandUpdated = renderRows<WIDTH, HEIGHT>(t, bandStart, bandEnd, std::max(jStart, runStart * PYRAMID_FACTOR), std::min(jEnd, runEnd * PYRAMID_FACTOR + PYRAMID_FACTOR - 1), e1x, e2x, e3x, coverage) || bandUpdated;
+		}
+
+		if (bandUpdated) {
+			dBuffer.updateLevel1(bandStart, bandEnd, jStart, jEnd);
+			updated = true;
+		}
+		if (shared) {
+			dBuffer.unlockBand(y);
+		}
+	}
+	return updated;
+}
+
+//given triangle points in NDC space (with their depths as z), render triangle into depth buffer and update depths as needed
+template<int WIDTH, int HEIGHT>
+static void renderIntoDepthBuffer(glm::vec3 t1, glm::vec3 t2, glm::vec3 t3) {
+	TriangleSetup t;
+	setupTriangle(t1, t2, t3, t);
 
-			//merge triangle into working layer
-			b.working = std::max(b.working, maxZ); //this might move the working layer deeper -- and is why the heuristic above is used
-			for (int k = 0; k < BLOCK_HEIGHT; k++) {
-				//x coordinates of events relative to this block and scanline
-				uint32_t e1 = std::max(0.0f, e1f[k] - j * 32.0f);
-				uint32_t e2 = std::max(0.0f, e2f[k] - j * 32.0f);
-				uint32_t e3 = std::max(0.0f, e3f[k] - j * 32.0f);
+	//triangle is behind everything in its bounding rectangle -- reject it without going through its blocks
+	if (!dBuffer.anyReferenceAtLeast(t.minZ, t.iStart, t.iEnd, t.jStart, t.jEnd)) {
+		return;
+	}
+
+	if (renderTriangle<WIDTH, HEIGHT>(t, t.iStart, t.iEnd, t.jStart, t.jEnd)) {
+		dBuffer.updateLevel2(t.iStart, t.iEnd, t.jStart, t.jEnd);
+	}
+}
+
+//triangles of the occluder being rasterized, and the screen-space bins they overlap
+//(kept between objects so their memory is reused)
+static std::vector<TriangleSetup> binnedTriangles;
+static std::vector<size_t> binnedPoints; //first point of each of binnedTriangles in the triangle buffer
+static std::vector<std::vector<uint32_t>> bins; //indices into binnedTriangles, in submission order
+static int binsX = 0; //number of bins horizontally
+static int binsY = 0; //number of bins vertically
+static std::vector<size_t> binsDone; //how many triangles of each bin were rendered before the time budget ran out
+
+/*	rasterize all triangles overlapping one bin, clipped to the bin
+
+	triangles are rendered in the same order as they were submitted, so every block
+	gets the same updates in the same order as when rendering serially
+
+	level 1 cells of the pyramid are updated by renderTriangle -- each one lies within one bin
+
+	with timeBudget, the rest of the bin is left out once the budget runs out -- a triangle left out of some
+	of its bins still hides what's behind it in the others
+*/
+template<int WIDTH, int HEIGHT>
+static void renderBin(int bin) {
+	int iStart = (bin / binsX) * BIN_HEIGHT;
+	int iEnd = std::min(iStart + BIN_HEIGHT, (int)dBuffer.heightB) - 1;
+	int jStart = (bin % binsX) * BIN_WIDTH;
+	int jEnd = std::min(jStart + BIN_WIDTH, (int)dBuffer.widthB) - 1;
+
+	const std::vector<uint32_t>& tris = bins[bin];
+	size_t k = 0;
+	for (; k < tris.size(); k++) {
+		if (timeBudget && tris[k] != 0 && outOfTime()) { //the first triangle always goes in, see updateDepthBuffer
+			break;
+		}
+		const TriangleSetup& t = binnedTriangles[tris[k]];
+		renderTriangle<WIDTH, HEIGHT>(t, std::max(t.iStart, iStart), std::min(t.iEnd, iEnd), std::max(t.jStart, jStart), std::min(t.jEnd, jEnd));
+	}
+	binsDone[bin] = k;
+}
+
+/*	rasterize triangles (3 points each, as written by transformPoints) from point first on using all threads
+
+	triangles are set up, sorted into bins of BIN_WIDTH x BIN_HEIGHT blocks, and then
+	each bin is rendered by one thread -- bins don't share blocks, so no locking is needed
+
+	returns the first point of the first triangle the time budget left out of any of its bins, or tris.count
+*/
+template<int WIDTH, int HEIGHT>
+static size_t renderBinned(const TriangleBuffer& tris, size_t first) {
+	binsX = (dBuffer.widthB + BIN_WIDTH - 1) / BIN_WIDTH;
+	binsY = (dBuffer.heightB + BIN_HEIGHT - 1) / BIN_HEIGHT;
+	bins.resize(binsX * binsY);
+	for (auto it = bins.begin(); it != bins.end(); it++) {
+		it->clear();
+	}
+
+	binnedTriangles.clear();
+	binnedPoints.clear();
+	size_t stop = tris.count;
+	int iStart = (int)dBuffer.heightB;
+	int iEnd = -1;
+	int jStart = (int)dBuffer.widthB;
+	int jEnd = -1;
+	for (size_t k = first; k < tris.count; k += 3) {
+		if (timeBudget && k != first && outOfTime()) {
+			skippedTriangles += (tris.count - k) / 3;
+			stop = k;
+			break;
+		}
 
-				uint32_t result = line(e1, e2, e3, mask1, mask2, mask3);
-				b.bits[k] |= result;
+		const GLfloat* x = &tris.x[k];
+		const GLfloat* y = &tris.y[k];
+		const GLfloat* z = &tris.z[k];
+
+		TriangleSetup t;
+		setupTriangle(glm::vec3(x[0], y[0], z[0]), glm::vec3(x[1], y[1], z[1]), glm::vec3(x[2], y[2], z[2]), t);
+		if (!dBuffer.anyReferenceAtLeast(t.minZ, t.iStart, t.iEnd, t.jStart, t.jEnd)) {
+			continue; //doesn't overlap the buffer, or is behind everything it overlaps
+		}
+
+		//bounding rectangle of all triangles, for updating level 2 of the pyramid afterwards
+		iStart = std::min(iStart, t.iStart);
+		iEnd = std::max(iEnd, t.iEnd);
+		jStart = std::min(jStart, t.jStart);
+		jEnd = std::max(jEnd, t.jEnd);
+
+		uint32_t index = (uint32_t)binnedTriangles.size();
+		binnedTriangles.push_back(t);
+		binnedPoints.push_back(k);
+		for (int by = t.iStart / BIN_HEIGHT; by <= t.iEnd / BIN_HEIGHT; by++) {
+			for (int bx = t.jStart / BIN_WIDTH; bx <= t.jEnd / BIN_WIDTH; bx++) {
+				bins[by * binsX + bx].push_back(index);
 			}
+		}
+	}
 
-			//update reference layer if mask is full
-			bool full = true;
-			for (int i = 0; i < BLOCK_HEIGHT; i++) {
-				full = (full && b.bits[i] == ~0);
+	binsDone.resize(bins.size());
+	parallelFor(binsX * binsY, renderBin<WIDTH, HEIGHT>);
+
+	//level 2 cells span several bins, so they're updated once all bins are done
+	if (iStart <= iEnd) {
+		dBuffer.updateLevel2(iStart, iEnd, jStart, jEnd);
+	}
+
+	//count the triangles left out of any of their bins because of the time budget -- bins are in submission order,
+	//so the first one left out of each bin is the earliest triangle it's missing
+	if (timeBudget) {
+		std::vector<bool> skipped(binnedTriangles.size(), false);
+		for (size_t bin = 0; bin < bins.size(); bin++) {
+			if (binsDone[bin] < bins[bin].size()) {
+				stop = std::min(stop, binnedPoints[bins[bin][binsDone[bin]]]);
 			}
-			if (full) {
-				b.reference = std::min(b.reference, b.working); //I use the min instead of just assigning b.reference as in the paper -- this produces slightly better results
-				b.working = 0.0f;
-				for (int i = 0; i < BLOCK_HEIGHT; i++) {
-					b.bits[i] = 0;
-				}
+			for (size_t k = binsDone[bin]; k < bins[bin].size(); k++) {
+				skipped[bins[bin][k]] = true;
 			}
-			/////////////////////////////////////
+		}
+		skippedTriangles += std::count(skipped.begin(), skipped.end(), true);
+	}
+	return stop;
+}
+
+//triangles being rendered by renderShared, the rectangle of blocks (rows x to y, columns z to w) each of its
+//tasks changed the reference depths of, and how many triangles each task left out because of the time budget
+//(kept between objects so their memory is reused)
+static const TriangleBuffer* sharedTriangles = nullptr;
+static size_t sharedFirst = 0; //point of sharedTriangles the first task starts at
+static std::vector<glm::ivec4> sharedRects;
+static std::vector<size_t> sharedSkipped;
+
+//the point of sharedTriangles where this task's triangles end
+static size_t sharedTaskEnd(int task) {
+	return std::min(sharedTriangles->count, sharedFirst + (size_t)(task + 1) * SHARED_TRIANGLES * 3);
+}
+
+//set up and rasterize triangles SHARED_TRIANGLES * task to SHARED_TRIANGLES * (task + 1) - 1 of sharedTriangles (from sharedFirst)
+template<int WIDTH, int HEIGHT>
+static void renderSharedTask(int task) {
+	const TriangleBuffer& tris = *sharedTriangles;
+	glm::ivec4 rect((int)dBuffer.heightB, -1, (int)dBuffer.widthB, -1);
+	size_t end = sharedTaskEnd(task);
+	sharedSkipped[task] = 0;
+	for (size_t k = sharedFirst + (size_t)task * SHARED_TRIANGLES * 3; k < end; k += 3) {
+		if (timeBudget && k != sharedFirst && outOfTime()) {
+			sharedSkipped[task] = (end - k) / 3;
+			break;
+		}
+
+		const GLfloat* x = &tris.x[k];
+		const GLfloat* y = &tris.y[k];
+		const GLfloat* z = &tris.z[k];
+
+		TriangleSetup t;
+		setupTriangle(glm::vec3(x[0], y[0], z[0]), glm::vec3(x[1], y[1], z[1]), glm::vec3(x[2], y[2], z[2]), t);
+		if (t.iStart > t.iEnd || t.jStart > t.jEnd) {
+			continue; //doesn't overlap the buffer
+		}
+
+		//there's no test against the pyramid first, as other threads may be changing it -- renderTriangle
+		//still skips the level 1 cells the triangle is behind, once it has locked them
+		if (renderTriangle<WIDTH, HEIGHT>(t, t.iStart, t.iEnd, t.jStart, t.jEnd, true)) {
+			rect.x = std::min(rect.x, t.iStart);
+			rect.y = std::max(rect.y, t.iEnd);
+			rect.z = std::min(rect.z, t.jStart);
+			rect.w = std::max(rect.w, t.jEnd);
 		}
 	}
+	sharedRects[task] = rect;
+}
+
+/*	rasterize triangles (3 points each, as written by transformPoints) from point first on using all threads, without binning them
+
+	each thread takes SHARED_TRIANGLES triangles at a time, sets them up and renders them straight into the depth
+	buffer, locking one band of blocks at a time (see renderTriangle) -- triangles of different threads can reach
+	a block in any order, so the result isn't always the same as when rendering serially
+
+	returns the first point of the first triangle the time budget left out, or tris.count
+*/
+template<int WIDTH, int HEIGHT>
+static size_t renderShared(const TriangleBuffer& tris, size_t first) {
+	int tasks = (int)(((tris.count - first) / 3 + SHARED_TRIANGLES - 1) / SHARED_TRIANGLES);
+	sharedTriangles = &tris;
+	sharedFirst = first;
+	sharedRects.resize(tasks);
+	sharedSkipped.resize(tasks);
+	parallelFor(tasks, renderSharedTask<WIDTH, HEIGHT>);
+
+	//level 2 cells are updated once all threads are done, like when binning
+	glm::ivec4 all((int)dBuffer.heightB, -1, (int)dBuffer.widthB, -1);
+	for (auto it = sharedRects.begin(); it != sharedRects.end(); it++) {
+		all = glm::ivec4(std::min(all.x, it->x), std::max(all.y, it->y), std::min(all.z, it->z), std::max(all.w, it->w));
+	}
+	if (all.x <= all.y) {
+		dBuffer.updateLevel2(all.x, all.y, all.z, all.w);
+	}
+
+	//each task left out the last of its triangles
+	size_t stop = tris.count;
+	for (int task = 0; task < tasks; task++) {
+		skippedTriangles += sharedSkipped[task];
+		if (sharedSkipped[task] != 0) {
+			stop = std::min(stop, sharedTaskEnd(task) - 3 * sharedSkipped[task]);
+		}
+	}
+	return stop;
 }
 
 /* update depth buffer based on object m
+
+	first -- the point of its transformed triangles to start at, as the ones before it are in the depth buffer already
+	returns true if all of its triangles went in -- if the time budget ran out partway, first is set to the point of
+	the first triangle left out (see skippedTriangles), and false is returned
+
+	the triangle at first always goes in, even once the time budget has run out, so an occluder cut off partway on
+	every frame still gets further each time
 */
-void updateDepthBuffer(const ModelCollection &m) {
+template<int WIDTH, int HEIGHT>
+static bool updateDepthBuffer(const ModelCollection &m, size_t& first) {
 
 	//transform and clip triangles with respect to the near plane
-	std::vector<glm::vec3> transformed;
-	transformPoints(m.occluderData, transformed, m.modelMatrix);
+	TriangleBuffer& tris = occluderTriangles;
+	transformPoints(worldPoints.data() + m.occluderStart, m.occluderCount, tris, m.doubleSided);
+
+	//spread big occluders over all threads -- this is finished before returning, so the next
+	//object is tested against the complete depth buffer, just like when rendering serially
+	if (threadCount > 1 && tris.count / 3 >= MIN_BINNED_TRIANGLES) {
+		if (sharedRendering) {
+			first = renderShared<WIDTH, HEIGHT>(tris, first);
+		} else {
+			first = renderBinned<WIDTH, HEIGHT>(tris, first);
+		}
+		return first == tris.count;
+	}
 
-	for (auto it = transformed.begin(); it != transformed.end();) { //while there are still triangles in the buffer
-		//get one triangle
-		glm::vec3& p1 = *it++;
-		glm::vec3& p2 = *it++;
-		glm::vec3& p3 = *it++;
+	for (size_t k = first; k < tris.count; k += 3) { //while there are still triangles in the buffer
+		//a few near triangles can take longer than the whole budget -- the ones rendered so far still hide what's behind them
+		if (timeBudget && k != first && outOfTime()) {
+			skippedTriangles += (tris.count - k) / 3;
+			first = k;
+			return false;
+		}
 
-		//max depth of triangle
-		GLfloat maxZ = std::max(p1.z, std::max(p2.z, p3.z));
+		//get one triangle
+		const GLfloat* x = &tris.x[k];
+		const GLfloat* y = &tris.y[k];
+		const GLfloat* z = &tris.z[k];
 
-		glm::vec2 t1(p1);
-		glm::vec2 t2(p2);
-		glm::vec2 t3(p3);
+		glm::vec3 t1(x[0], y[0], z[0]);
+		glm::vec3 t2(x[1], y[1], z[1]);
+		glm::vec3 t3(x[2], y[2], z[2]);
 
 		//do rasterization/updates in depth buffer
-		renderIntoDepthBuffer(t1, t2, t3, maxZ);
+		renderIntoDepthBuffer<WIDTH, HEIGHT>(t1, t2, t3);
+	}
+	first = tris.count;
+	return true;
+}
+
+//boxVisible for a depth buffer with blocks HEIGHT pixels high
+template<int WIDTH, int HEIGHT>
+static bool boxVisibleBlocks(const WorldBounds& b) {
+	//Project bounding box into bounding square -- if it crosses the near plane it covers the whole screen,
+	//so it's visible without looking at the depth buffer
+	GLfloat minX, maxX, minY, maxY, minZ, maxZ;
+	bool inFront = projectBox(b, viewProject, minX, maxX, minY, maxY, minZ, maxZ);
+
+	//Depth test
+	return !inFront || depthTest<WIDTH, HEIGHT>(minX, maxX, minY, maxY, minZ);
+}
+
+//true if box might be visible according to the depth buffer -- see header
+bool boxVisible(const WorldBounds& b) {
+	switch (dBuffer.blockHeight) {
+	case 4:
+		return dBuffer.blockWidth == 64 ? boxVisibleBlocks<64, 4>(b) : boxVisibleBlocks<32, 4>(b);
+	case 16:
+		return dBuffer.blockWidth == 64 ? boxVisibleBlocks<64, 16>(b) : boxVisibleBlocks<32, 16>(b);
+	default:
+		return dBuffer.blockWidth == 64 ? boxVisibleBlocks<64, 8>(b) : boxVisibleBlocks<32, 8>(b);
+	}
+}
+
+//1 for each object (in the order of worldBounds) whose occluder selectOccluders picked this frame
+static std::vector<uint8_t> selectedOccluders;
+
+//pick the occluders to render this frame -- see header
+void selectOccluders(const std::vector<ModelCollection*>& objects) {
+	//pixels covered by the bounding box of each object in view, per triangle of its occluder
+	static std::vector<std::pair<GLfloat, const ModelCollection*>> candidates;
+	candidates.clear();
+	const GLfloat pixels = (GLfloat)dBuffer.width * (GLfloat)dBuffer.height / 4.0f; //per unit of NDC area
+	for (auto it = objects.begin(); it != objects.end(); it++) {
+		const ModelCollection& m = **it;
+		const WorldBounds& b = worldBounds[m.boundsIndex];
+		if (m.occluderCount < 3 || !sphereInFrustum(b.center, b.radius)) {
+			continue;
+		}
+		GLfloat minX, maxX, minY, maxY, minZ, maxZ;
+		GLfloat area = 4.0f * pixels; //boxes crossing the near plane cover the whole screen
+		if (projectBox(b, viewProject, minX, maxX, minY, maxY, minZ, maxZ)) {
+			GLfloat w = std::max(std::min(maxX, 1.0f) - std::max(minX, -1.0f), 0.0f);
+			GLfloat h = std::max(std::min(maxY, 1.0f) - std::max(minY, -1.0f), 0.0f);
+			area = w * h * pixels;
+		}
+		candidates.push_back(std::make_pair(area / (GLfloat)(m.occluderCount / 3), &m));
+	}
+
+	//best first, as long as they fit in the budget
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<GLfloat, const ModelCollection*>& a, const std::pair<GLfloat, const ModelCollection*>& b) {
+		return a.first > b.first;
+	});
+	selectedOccluders.assign(worldBounds.size(), 0);
+	int triangles = 0;
+	for (auto it = candidates.begin(); it != candidates.end(); it++) {
+		int count = (int)(it->second->occluderCount / 3);
+		if (triangles + count <= budgetTriangles) {
+			triangles += count;
+			selectedOccluders[it->second->boundsIndex] = 1;
+		}
+	}
+}
+
+//shouldDraw for a depth buffer with blocks HEIGHT pixels high
+template<int WIDTH, int HEIGHT>
+static bool shouldDrawBlocks(const ModelCollection& m) {
+	const WorldBounds& b = worldBounds[m.boundsIndex];
+
+	//objects entirely outside the view frustum can't be seen
+	if (!sphereInFrustum(b.center, b.radius)) {
+		return false;
+	}
+
+	if (!boxVisibleBlocks<WIDTH, HEIGHT>(b)) {
+		return false;
+	}
+	if (occluderBudget && !selectedOccluders[m.boundsIndex]) {
+		return true; //too small for its triangles -- it's only tested
+	}
+	if (keepDepths && keptOccluders[m.boundsIndex]) {
+		return true; //its depths are in the buffer already
+	}
+
+	//out of time -- the rest of the frame is only tested
+	if (timeBudget && outOfTime()) {
+		skippedOccluders++;
+		skippedTriangles += m.occluderCount / 3;
+		return true;
 	}
 
+	//an occluder the time budget cut off partway carries on from the first triangle it left out on the next still frame
+	size_t first = keepDepths ? keptPoints[m.boundsIndex] : 0;
+	bool complete = updateDepthBuffer<WIDTH, HEIGHT>(m, first);
+	if (keepDepths) {
+		keptOccluders[m.boundsIndex] = complete ? 1 : 0;
+		keptPoints[m.boundsIndex] = first;
+	}
+	return true;
 }
 
 /*		true if object is visible and should be drawn
@@ -565,17 +1582,83 @@ void updateDepthBuffer(const ModelCollection &m) {
 	does bounding box visibility test, and if visible, will update the depth buffer using the occluder
 
 	call this function in the renderer
+
+	the culling code is compiled for each supported block height, so the height is only looked at here
 */
 bool shouldDraw(const ModelCollection& m) {
-	//Transform bounding box into bounding square
-	GLfloat minX, maxX, minY, maxY, minZ, maxZ;
-	transformBoundingBox(m, minX, maxX, minY, maxY, minZ, maxZ);
+	switch (dBuffer.blockHeight) {
+	case 4:
+		return dBuffer.blockWidth == 64 ? shouldDrawBlocks<64, 4>(m) : shouldDrawBlocks<32, 4>(m);
+	case 16:
+		return dBuffer.blockWidth == 64 ? shouldDrawBlocks<64, 16>(m) : shouldDrawBlocks<32, 16>(m);
+	default:
+		return dBuffer.blockWidth == 64 ? shouldDrawBlocks<64, 8>(m) : shouldDrawBlocks<32, 8>(m);
+	}
+}
 
-	//Depth test
-	bool visible = depthTest(minX, maxX, minY, maxY, minZ, maxZ);
-	if (visible) {
-		updateDepthBuffer(m);
+//objects of phase two of cullBatched, which are objects[batchStart] to objects[batchEnd - 1]
+static const std::vector<ModelCollection*>* batchObjects = nullptr;
+static std::vector<int>* batchFlags = nullptr;
+static size_t batchStart = 0;
+static size_t batchEnd = 0;
+
+//test objects batchStart + BATCH_TESTS * task onwards -- only reads the depth buffer, so tasks can run at the same time
+static void testBatch(int task) {
+	size_t start = batchStart + (size_t)task * BATCH_TESTS;
+	size_t end = std::min(batchEnd, start + BATCH_TESTS);
+	for (size_t i = start; i < end; i++) {
+		const WorldBounds& b = worldBounds[(*batchObjects)[i]->boundsIndex];
+		(*batchFlags)[i] = sphereInFrustum(b.center, b.radius) && boxVisible(b) ? 1 : 0;
+	}
+}
+
+//cull objects in two phases -- see header
+void cullBatched(const std::vector<ModelCollection*>& objects, size_t count, size_t occluderCount, std::vector<int>& flags) {
+	//phase one -- the nearest objects are tested and rendered one by one, so occluders hidden by nearer ones are skipped
+	size_t occluders = std::min(occluderCount, count);
+	for (size_t i = 0; i < occluders; i++) {
+		flags[i] = shouldDraw(*objects[i]) ? 1 : 0;
+	}
+
+	//phase two -- the depth buffer is finished, so the other objects are just tested against it
+	batchObjects = &objects;
+	batchFlags = &flags;
+	batchStart = occluders;
+	batchEnd = count;
+	parallelFor((int)((count - occluders + BATCH_TESTS - 1) / BATCH_TESTS), testBatch);
+}
+
+//cull objects with the visible ones of last frame first -- see header
+void cullVisibleFirst(const std::vector<ModelCollection*>& objects, size_t count, std::vector<int>& flags) {
+	//objects drawn last frame are culled first, rendering their occluders -- the others are put aside in order
+	static std::vector<ModelCollection*> rest;
+	static std::vector<int> restFlags;
+	static std::vector<size_t> restIndices; //index of each of them in objects
+	rest.clear();
+	restIndices.clear();
+	for (size_t i = 0; i < count; i++) {
+		if (objects[i]->wasVisible) {
+			flags[i] = shouldDraw(*objects[i]) ? 1 : 0;
+		} else {
+			rest.push_back(objects[i]);
+			restIndices.push_back(i);
+		}
 	}
 
-	return visible;
+	//objects hidden last frame are tested against those occluders on all threads at once -- most stay hidden
+	restFlags.resize(rest.size());
+	batchObjects = &rest;
+	batchFlags = &restFlags;
+	batchStart = 0;
+	batchEnd = rest.size();
+	parallelFor((int)((rest.size() + BATCH_TESTS - 1) / BATCH_TESTS), testBatch);
+
+	//the ones that came into view are culled again one by one, so their occluders are rendered and can hide each other
+	for (size_t k = 0; k < rest.size(); k++) {
+		flags[restIndices[k]] = restFlags[k] && shouldDraw(*rest[k]) ? 1 : 0;
+	}
+
+	for (size_t i = 0; i < objects.size(); i++) {
+		objects[i]->wasVisible = i < count && flags[i] != 0;
+	}
 }
@@ -14,20 +14,73 @@
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
-#include <iostream>
+#include <cstdint>
+#include <type_traits>
+#include <atomic>
 
 #include "models.h"
 #include <vector>
 
 
+//default size of the depth buffer, can be changed at startup with -buffer (see main.cpp)
 //these should match screen resolution defined in draw.h, but they don't need to
-#define BUFFER_WIDTH 1440 //width in pixels of depth buffer -- must be a multiple of 32 (width of uint32_t)
-#define BUFFER_HEIGHT 1024 //height in pixels of depth buffer -- must be a multiple of BLOCK_HEIGHT
+#define DEFAULT_BUFFER_WIDTH 1440 //width in pixels of depth buffer -- should be a multiple of the block width
+#define DEFAULT_BUFFER_HEIGHT 1024 //height in pixels of depth buffer -- should be a multiple of the block height
 
 //height in pixels of a block, 8 is used because in the original paper's implementation, AVX instructions
 //are used to operate on 8 uint32_ts at a time, making it so an entire block can be dealt with using
 //a few AVX instructions
-#define BLOCK_HEIGHT 8
+//4 and 16 can be chosen at startup with -block -- the culling code is compiled for each of these heights
+//(see shouldDraw), so the loops over the scanlines of a block are unrolled for every one of them
+#define DEFAULT_BLOCK_HEIGHT 8
+
+//width in pixels of a block -- each scanline of a block is one uint32_t mask
+//64 (uint64_t masks) can be chosen at startup with -block, which halves the number of blocks (and their depth updates)
+//for big occluders, at the cost of coarser depths -- the culling code is compiled for both widths too
+#define DEFAULT_BLOCK_WIDTH 32
+
+//size in blocks of the screen-space bins used when occluders are rasterized by several threads
+//each bin is rendered by one thread at a time, so threads never touch the same blocks
+#define BIN_WIDTH 4
+#define BIN_HEIGHT 8
+
+//occluders with fewer triangles than this are rasterized by the main thread alone
+#define MIN_BINNED_TRIANGLES 16
+
+//triangles a thread sets up and renders at a time when threads render into the depth buffer together (see sharedRendering)
+#define SHARED_TRIANGLES 4
+
+//default number of nearest objects whose occluders are rendered by batched culling (see cullBatched)
+#define BATCH_OCCLUDERS 8
+
+//objects a thread tests at a time in the second phase of batched culling
+#define BATCH_TESTS 16
+
+//default number of occluder triangles rendered per frame when occluders are picked by selectOccluders
+#define OCCLUDER_BUDGET 256
+
+//triangles are set up in fixed point pixel space with this many bits of sub-pixel precision (see setupTriangle)
+#define SUBPIXEL_BITS 8
+
+//occluder triangles are clipped to a frustum this many times wider and taller than the view frustum (see transformPoints)
+//so their points stay near the depth buffer -- clipping only happens for triangles reaching outside of it
+#define GUARD_BAND 2
+
+//triangles with a point further than this many pixels from the origin of the depth buffer aren't rendered, so the
+//fixed point edge math fits in 64 bits -- leaving out an occluder only makes culling less effective, never wrong
+//the guard band keeps occluders well inside this
+#define FIXED_RANGE (1 << 20)
+
+//x coordinate of an event that's far outside of every block -- used for edges that cover or miss whole scanlines
+#define EVENT_FAR (1 << 30)
+
+//alignment in bytes of the arrays of the depth buffer -- the masks of a block (16, 32 or 64 bytes) then never straddle cache lines
+#define CACHE_LINE_SIZE 64
+
+//the depth buffer keeps the max reference depth of groups of PYRAMID_FACTOR x PYRAMID_FACTOR blocks (level 1),
+//and of groups of PYRAMID_FACTOR x PYRAMID_FACTOR level 1 cells (level 2), so large regions can be rejected at once
+//BIN_WIDTH and BIN_HEIGHT must be multiples of this, so each level 1 cell belongs to one bin
+#define PYRAMID_FACTOR 4
 
 /*	
 
@@ -44,6 +97,9 @@
 */
 uint32_t line(uint32_t e0, uint32_t e1, uint32_t e2, uint32_t o0, uint32_t o1, uint32_t o2);
 
+//the same for blocks 64 pixels wide
+uint64_t line(uint32_t e0, uint32_t e1, uint32_t e2, uint64_t o0, uint64_t o1, uint64_t o2);
+
 /*		render triangle specified by these points in NDC coordinates,
 		into the depth buffer. assumes clipping with near plane has already been done
 
@@ -55,39 +111,333 @@ void rasterize(glm::vec2 t1, glm::vec2 t2, glm::vec2 t3);
 
 
 /*
-	Tile as specified by the Hasselgren et al. paper
+	Tiles as specified by the Hasselgren et al. paper
 */
-//One block or "tile" of the depth buffer
-//a pixel belongs to the working depth if its bit is set, otherwise it belongs to the reference depth
-struct Block {
-	uint32_t bits[BLOCK_HEIGHT]; //the bit mask of the block
-	GLfloat reference; //reference depth (zMax0 in the paper)
-	GLfloat working; //working depth (zMax1 in the paper)
+//mask of one scanline of a block WIDTH pixels wide
+template<int WIDTH>
+using BlockMask = typename std::conditional<WIDTH == 64, uint64_t, uint32_t>::type;
 
-	void reset(); //reset this block (use this every frame)
+//One row of blocks or "tiles" of the depth buffer, WIDTH pixels wide and HEIGHT scanlines high
+//the parts of the blocks are kept in separate arrays -- block j of the row has its masks at bits + j * HEIGHT
+//a pixel belongs to the working depth if its bit is set, otherwise it belongs to the reference depth
+template<int WIDTH, int HEIGHT>
+struct BlockRow {
+	BlockMask<WIDTH>* bits; //the bit masks of the blocks, HEIGHT scanlines each
+	GLfloat* reference; //reference depths (zMax0 in the paper)
+	GLfloat* working; //working depths (zMax1 in the paper)
 };
 
-//Depth buffer containing all blocks
+//true if the culling code is compiled for blocks of this height (4, 8 or 16)
+bool supportedBlockHeight(int blockHeight);
+
+//true if the culling code is compiled for blocks of this width (32 or 64)
+bool supportedBlockWidth(int blockWidth);
+
+/*	Depth buffer containing all blocks
+
+	block (x, y) is number y * widthB + x in each of the arrays below, which start on a cache line
+	the reference depths are packed together, so depth tests read nothing else
+
+	a cleared block has a reference depth of 1.0 (the maximum depth), a working depth of 0 and an empty mask
+	only the reference depths are cleared by reset -- the masks and working depths of a block are cleared
+	the first time it's rendered into in a frame (see touch), so blocks no occluder covers are never written to
+*/
 struct DepthBuffer {
-	Block* arr; //array of blocks composing the depth buffer
+	void* bits; //masks of all blocks, blockHeight per block -- they're BlockMask<blockWidth>, use row() to get them
+	GLfloat* reference; //reference depths of all blocks
+	GLfloat* working; //working depths of all blocks
+	uint32_t* epochs; //epoch each block was last cleared in -- its masks and working depth are stale if it isn't epoch
+	uint32_t epoch; //incremented by reset
 	uint32_t blockCount; //how many blocks exist in this buffer
 
+	uint32_t width; //width of buffer in pixels
+	uint32_t height; //height of buffer in pixels
+	uint32_t blockWidth; //width of blocks in pixels
+	uint32_t blockHeight; //height of blocks in pixels
+
 	uint32_t widthB; //width of buffer in blocks
 	uint32_t heightB; //height of buffer in blocks
 
-	DepthBuffer();
+	//max reference depth pyramid -- cells at the right/bottom edges can cover fewer blocks
+	GLfloat* level1; //max reference depth of each group of PYRAMID_FACTOR x PYRAMID_FACTOR blocks
+	GLfloat* level2; //max reference depth of each group of PYRAMID_FACTOR x PYRAMID_FACTOR level 1 cells
+	uint32_t width1, height1; //size of level 1 in cells
+	uint32_t width2, height2; //size of level 2 in cells
+
+	/*	one lock for each row of level 1 cells -- a thread rendering into a band of blocks one level 1 cell high holds its
+		lock, so threads can render into the buffer at the same time (see sharedRendering)
+
+		blocks aren't updated with a 16 byte compare and swap instead, as none of the supported block sizes fit in one:
+		a 32x4 block already has 16 bytes of masks before its two depths, and its working depth has to change together
+		with its masks -- otherwise a thread could merge another thread's coverage with a depth nearer than it
+		the lock also covers the band's level 1 cells, which a triangle reads before rendering and updates after
+	*/
+	std::atomic<uint32_t>* bandLocks;
+
+	DepthBuffer(); //make buffer of the default size
 
 	~DepthBuffer();
 
-	void reset(); //clear all blocks
+	/*	make buffer of width x height pixels with blocks of blockWidth x blockHeight pixels -- contents are lost
 
-	Block& getBlock(int x, int y); //get block reference -- coordinates refer to blocks, (0,0) is top left
+		width and height are rounded up to whole blocks, and the block size must be supported
+		(see supportedBlockWidth and supportedBlockHeight)
+	*/
+	void resize(uint32_t width, uint32_t height, uint32_t blockWidth, uint32_t blockHeight);
+
+	void reset(); //clear all blocks -- see above
+
+	//row of blocks starting at block (0, y), (0, 0) is top left -- WIDTH and HEIGHT must be blockWidth and blockHeight
+	template<int WIDTH, int HEIGHT>
+	BlockRow<WIDTH, HEIGHT> row(int y) {
+		BlockRow<WIDTH, HEIGHT> r;
+		r.bits = (BlockMask<WIDTH>*) bits + y * widthB * HEIGHT;
+		r.reference = reference + y * widthB;
+		r.working = working + y * widthB;
+		return r;
+	}
+
+	//clear the masks and working depths of blocks jStart..jEnd of row y that haven't been cleared this frame
+	//call before rendering into them -- WIDTH and HEIGHT must be blockWidth and blockHeight
+	template<int WIDTH, int HEIGHT>
+	void touch(int y, int jStart, int jEnd) {
+		BlockMask<WIDTH>* masks = (BlockMask<WIDTH>*) bits;
+		for (uint32_t k = y * widthB + jStart; k <= y * widthB + jEnd; k++) {
+			if (epochs[k] != epoch) {
+				epochs[k] = epoch;
+				working[k] = 0.0f;
+				for (int r = 0; r < HEIGHT; r++) {
+					masks[k * HEIGHT + r] = 0;
+				}
+			}
+		}
+	}
+
+	//recompute the level 1 cells covering blocks in rows iStart..iEnd and columns jStart..jEnd
+	void updateLevel1(int iStart, int iEnd, int jStart, int jEnd);
+
+	//recompute the level 2 cells covering these blocks from level 1
+	void updateLevel2(int iStart, int iEnd, int jStart, int jEnd);
+
+	/*	true if any block in rows iStart..iEnd and columns jStart..jEnd has a reference depth >= z
+
+		goes down the pyramid, so regions where everything is nearer than z are skipped without looking at their blocks
+	*/
+	bool anyReferenceAtLeast(GLfloat z, int iStart, int iEnd, int jStart, int jEnd);
+
+	void lockBand(int y); //wait until no other thread holds the lock of row y of level 1 cells, and take it
+	void unlockBand(int y);
 
 	void print(); //print depth buffer's masks to stdout -- used to debug/visualize depth buffer
 };
 
 extern DepthBuffer dBuffer; //global depth buffer
 
+/*	one triangle edge as an exact fixed point line
+
+	the event of the edge on scanline y (the first pixel whose center is right of the edge) is
+	y * q + ceil((n + y * r) / d), with 0 <= r < d -- so going down one scanline is an integer step of q pixels,
+	plus one more whenever the remainders add up to d
+*/
+struct EdgeSetup {
+	int64_t n; //numerator on scanline 0
+	int64_t r; //remainder of the slope, added to the numerator per scanline
+	int64_t d; //denominator
+	int64_t q; //whole pixels the edge moves per scanline
+};
+
+//triangle that is ready to be rasterized into the depth buffer (see setupTriangle)
+struct TriangleSetup {
+	EdgeSetup edge1, edge2, edge3; //edges from the top point to the middle one, top to bottom, and middle to bottom
+	uint32_t mask1, mask2, mask3; //masks used to flip the edges (see line())
+	int yStart, yEnd; //scanlines the triangle covers (inclusive)
+	GLfloat minZ; //depth of nearest point of triangle
+	GLfloat maxZ; //depth of triangle (farthest point)
+	double z0, zx, zy; //depth plane of triangle -- the depth at pixel space point (x, y) is z0 + x * zx + y * zy
+
+	//range of blocks possibly overlapping the triangle (inclusive) -- empty if it covers no pixel centers
+	int iStart, iEnd; //rows
+	int jStart, jEnd; //columns
+};
+
+/*	compute everything needed to rasterize a triangle into the depth buffer
+
+	t1, t2, t3 -- points of triangle in NDC space, with their depths as z
+
+	the points are snapped to fixed point pixel space (SUBPIXEL_BITS bits of sub-pixel precision), and a pixel is
+	covered if its center is inside the triangle -- centers exactly on an edge belong to the triangle to the right of
+	the edge, or below it if the edge is horizontal (the top-left rule), so triangles sharing an edge never both cover
+	a pixel of it, and never both leave it out
+*/
+void setupTriangle(glm::vec3 t1, glm::vec3 t2, glm::vec3 t3, TriangleSetup& t);
+
+/*	rasterize the part of a triangle within rows iStart..iEnd and columns jStart..jEnd of blocks into the depth buffer
+
+	level 1 cells that are entirely nearer than the triangle are skipped, and so are blocks the triangle misses
+	blocks it covers entirely are updated without making their masks, so only blocks along its edges go to the kernels
+	the level 1 cells of blocks whose reference depth changed are updated -- level 2 isn't, so the caller should use updateLevel2 if true is returned
+
+	shared -- other threads may be rendering into the same blocks, so each band of blocks one level 1 cell high is
+	locked while it's rendered (see DepthBuffer::lockBand)
+
+	WIDTH and HEIGHT must be the block size of the depth buffer
+*/
+template<int WIDTH, int HEIGHT>
+bool renderTriangle(const TriangleSetup& t, int iStart, int iEnd, int jStart, int jEnd, bool shared = false);
+
+/*	triangles transformed into NDC space by transformPoints, kept as separate arrays of x, y, z and w
+
+	point k of triangle t is at index 3 * t + k, and count is the number of points in use
+	w is the clip-space w of each point (before the perspective divide), the others are after it
+
+	the arrays only grow, so once a buffer is big enough, filling it again doesn't allocate
+*/
+struct TriangleBuffer {
+	std::vector<GLfloat> x, y, z, w;
+	size_t count; //number of points in use
+
+	TriangleBuffer() : count(0) {}
+
+	void clear() { count = 0; } //keeps memory
+	void add(const glm::vec4& p, GLfloat clipW); //add point p (after perspective divide) with clip-space w clipW
+};
+
+/*	occluder points of every object in the scene in world space, one object after another
+
+	objects don't move, so their model matrices are applied once by bakeScene, and only the view-projection
+	matrix is applied to these points every frame
+*/
+extern std::vector<glm::vec3> worldPoints;
+
+//bounding box of an object in world space
+struct WorldBounds {
+	//corners of the box -- the model matrix can rotate it, so these are kept instead of a min and max
+	GLfloat cornerX[8];
+	GLfloat cornerY[8];
+	GLfloat cornerZ[8];
+
+	//sphere around the box, for rejecting objects outside the view frustum quickly
+	glm::vec3 center;
+	GLfloat radius;
+};
+
+extern std::vector<WorldBounds> worldBounds; //bounds of every object in the scene, made by bakeScene
+
+//world space axis aligned boxes around the bounding boxes of all objects (in the same order as worldBounds),
+//kept as separate arrays so the frustum test can do several boxes at once
+struct WorldBoxes {
+	std::vector<GLfloat> minX, minY, minZ;
+	std::vector<GLfloat> maxX, maxY, maxZ;
+};
+
+extern WorldBoxes worldBoxes; //made by bakeScene
+
+//fill worldPoints and worldBounds from the occluder and bounding box data of these objects, and set their indices in them
+//also builds the hierarchy over the objects (see bvh.h)
+//call this after making a scene, and again if a model matrix changes
+void bakeScene(std::vector<ModelCollection>& models);
+
+//planes of the view frustum in world space (xyz is the inward unit normal, w the offset) -- set by startCulling
+extern glm::vec4 frustumPlanes[6];
+
+//call before culling the objects of a frame -- clears the depth buffer and uses the current view and projection matrices
+//the depth buffer may be kept from the last frame instead (see keepDepths)
+void startCulling();
+
+/*	keep the depth buffer of the last frame while the camera is still? -- -keepdepths turns it on
+
+	while the camera doesn't move or turn at all, the depth buffer isn't cleared between frames, and objects whose
+	occluders are in it already aren't rendered again -- so after the first frame, only objects that weren't rendered
+	yet (because of the time budget, for instance) are, and an occluder the time budget cut off partway carries on from
+	the first of its triangles that was left out
+
+	frames where the view changed are culled as usual -- the depths aren't reprojected into a turned view, as doing that
+	conservatively for every block cost more than rendering these scenes' occluders again
+*/
+extern bool keepDepths;
+
+//test every object against the view frustum at once -- call after startCulling when culling objects one by one
+//(the hierarchy in bvh.h only tests the objects of nodes inside the frustum)
+void frustumTestAll();
+
+//true if the object is at least partly inside the view frustum of this frame (as tested by frustumTestAll)
+//objects outside it can't be seen, so they don't need to be sorted or given to shouldDraw
+bool inFrustum(const ModelCollection& m);
+
+//test occludees per pixel? otherwise a box is visible if any block it overlaps has a reference depth at least as deep as it
+//per pixel, pixels whose bits are set in a block with a nearer working depth hide it too -- -precise turns it on
+extern bool preciseTest;
+
+//rasterize big occluders by handing their triangles out to all threads, which render into the depth buffer at the
+//same time? otherwise triangles are sorted into bins first, so threads never share blocks -- -shared turns it on
+//shared rendering saves the binning, but blocks may get triangles in a different order from run to run, so which
+//objects are culled can change a little (it stays conservative)
+extern bool sharedRendering;
+
+//true if this world space box might be visible according to the depth buffer -- the depth buffer isn't changed
+//used to test a group of objects at once
+bool boxVisible(const WorldBounds& b);
+
 //true if object should be drawn according to depth buffer -- also updates depth buffer
 //this is the function used in the renderer
 bool shouldDraw(const ModelCollection& m);
+
+//cull objects in two phases with cullBatched? otherwise each object is tested and then rendered before the next one
+//-batched n turns it on, with the n nearest objects as occluders
+extern bool batchedCulling;
+extern int batchOccluders; //number of objects whose occluders are rendered in the first phase
+
+/*	cull objects[0] to objects[count - 1], which should be sorted front to back, in two phases
+
+	phase one culls the first occluderCount objects one by one with shouldDraw, which renders the occluders of the
+	visible ones -- phase two then tests the boxes of all the others against the finished depth buffer, on all threads
+	at once as nothing is rendered any more
+
+	flags[i] is set to 1 if objects[i] should be drawn, or 0 if not
+*/
+void cullBatched(const std::vector<ModelCollection*>& objects, size_t count, size_t occluderCount, std::vector<int>& flags);
+
+//only render the occluders picked by selectOccluders? -budget n turns it on, with a budget of n triangles
+extern bool occluderBudget;
+extern int budgetTriangles;
+
+/*	pick the occluders worth rendering this frame, out of the objects in view -- call after startCulling
+
+	occluders are ranked by the screen area of their object's bounding box per triangle, and the best ones are picked
+	until budgetTriangles triangles are used up -- far away objects covering a few pixels rarely hide anything, so the
+	objects whose occluders aren't picked are still tested by shouldDraw, but their occluders aren't rendered
+*/
+void selectOccluders(const std::vector<ModelCollection*>& objects);
+
+/*	stop rendering occluders once culling a frame has taken budgetMicroseconds? -timebudget n turns it on
+
+	the time is counted from startCulling -- after that, shouldDraw still tests the remaining objects, but doesn't
+	render their occluders, so culling gets less tight instead of slower in the frames where it would take longest
+
+	an occluder is cut off between triangles once time runs out, as one near occluder can take longer than the whole
+	budget -- big occluders spread over several threads are cut off by each thread on its own (see renderBin and
+	renderSharedTask)
+*/
+extern bool timeBudget;
+extern double budgetMicroseconds;
+
+//occluders of visible objects that weren't rendered because the time budget ran out this frame, and their triangles
+//(skippedTriangles also counts the triangles left out of an occluder cut off partway, even if only some threads left them out)
+extern size_t skippedOccluders;
+extern size_t skippedTriangles;
+
+//cull objects with cullVisibleFirst? -visiblefirst turns it on
+extern bool visibleFirst;
+
+/*	cull objects[0] to objects[count - 1], which should be sorted front to back, starting with the ones drawn last frame
+
+	the objects drawn last frame are culled first with shouldDraw, so their occluders are rendered before anything
+	else is tested -- they're most likely still in view, and in front of everything else, even when the order by
+	distance says otherwise. the other objects are then tested against that depth buffer on all threads at once, and
+	the ones whose status flips to visible are culled again one by one, rendering their occluders. objects that turn
+	hidden were hidden by occluders that are really there, so they stay hidden
+
+	flags[i] is set to 1 if objects[i] should be drawn, or 0 if not, and wasVisible of every object is updated for the
+	next frame -- the objects after count are taken to be outside the view frustum
+*/
+void cullVisibleFirst(const std::vector<ModelCollection*>& objects, size_t count, std::vector<int>& flags);
@@ -1,6 +1,7 @@
 #include "draw.h"
 #include "control.h"
 #include "cull.h"
+#include "bvh.h"
 #include <ctime>
 #include <chrono>
 #include <glm/gtc/matrix_transform.hpp>
@@ -337,6 +338,8 @@ void makeDefaultScene() {
 	blueOffice.modelMatrix = glm::rotate(blueOffice.modelMatrix, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
 	sceneModels.push_back(blueOffice);
 
+	bakeScene(sceneModels); //world space data for culling
+
 	for (auto it = sceneModels.begin(); it != sceneModels.end(); it++) {
 		sceneModelPointers.push_back(&(*it));
 		sceneModelFlags.push_back(0);
@@ -469,15 +472,73 @@ void makeAlternateScene() {
 	purpleOffice.modelMatrix = glm::rotate(purpleOffice.modelMatrix, (GLfloat) 0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
 	sceneModels.push_back(purpleOffice);
 
+	bakeScene(sceneModels); //world space data for culling
+
 	for (auto it = sceneModels.begin(); it != sceneModels.end(); it++) {
 		sceneModelPointers.push_back(&(*it));
 		sceneModelFlags.push_back(0);
 	}
 }
 
-//Compare models -- used to sort objects in the scene by their distance to the camera
-bool modelPointerComparator(ModelCollection *m1, ModelCollection *m2) {
-	return distSquaredToCamera(*m1) < distSquaredToCamera(*m2);
+/*	scene objects in the order they were sorted last frame
+
+	the camera only moves a little between frames, so this order is almost right, and an insertion sort
+	seeded with it fixes it in close to one pass -- only the objects inside the view frustum are sorted, and
+	written back to the places they had, so objects outside keep their old place until they come back in
+*/
+static std::vector<ModelCollection*> sortedModels;
+static std::vector<SortEntry> frustumModels; //objects inside the view frustum this frame, with their distances
+static std::vector<size_t> frustumSlots; //where each of them was in sortedModels
+
+//an insertion sort that has moved objects more than this many places per object gives up and std::stable_sort is
+//used -- when the camera jumps, the last order doesn't help
+#define MAX_INSERTION_MOVES 8
+
+/*	sort the objects inside the view frustum front to back into the start of sceneModelPointers, starting from
+	last frame's order -- the others go to the end, in no particular order
+
+	frustumTestAll must have been called this frame -- returns the number of objects inside the view frustum
+*/
+static size_t sortScene() {
+	size_t count = sceneModelPointers.size();
+	if (sortedModels.size() != count) { //first frame
+		sortedModels = sceneModelPointers;
+	}
+
+	frustumModels.clear();
+	frustumSlots.clear();
+	size_t outside = count;
+	for (size_t i = 0; i < count; i++) {
+		ModelCollection* m = sortedModels[i];
+		if (inFrustum(*m)) {
+			frustumModels.push_back({ distSquaredToCamera(*m), m });
+			frustumSlots.push_back(i);
+		} else {
+			sceneModelPointers[--outside] = m;
+		}
+	}
+
+	size_t inside = frustumModels.size();
+	size_t moves = 0;
+	size_t maxMoves = MAX_INSERTION_MOVES * inside;
+	for (size_t i = 1; i < inside && moves <= maxMoves; i++) {
+		SortEntry e = frustumModels[i];
+		size_t j = i;
+		for (; j > 0 && e.key < frustumModels[j - 1].key; j--) {
+			frustumModels[j] = frustumModels[j - 1];
+		}
+		frustumModels[j] = e;
+		moves += i - j;
+	}
+	if (moves > maxMoves) {
+		std::stable_sort(frustumModels.begin(), frustumModels.end(), [](const SortEntry& a, const SortEntry& b) { return a.key < b.key; });
+	}
+
+	for (size_t i = 0; i < inside; i++) {
+		sortedModels[frustumSlots[i]] = frustumModels[i].m;
+		sceneModelPointers[i] = frustumModels[i].m;
+	}
+	return inside;
 }
 
 //render the current scene
@@ -496,12 +557,29 @@ void renderScene() {
 	//Start of culling
 
 	std::chrono::high_resolution_clock::time_point cullStart = std::chrono::high_resolution_clock::now();
-	std::sort(sceneModelPointers.begin(), sceneModelPointers.end(), modelPointerComparator); //sort scene objects
-	dBuffer.reset();
-	for (size_t i = 0; i < modelCount; i++) {
-		sceneModelFlags[i] = 0;
-		if (shouldDraw(*sceneModelPointers[i])) {
-			sceneModelFlags[i] = 1;
+	startCulling();
+	if (occluderBudget) {
+		selectOccluders(sceneModelPointers);
+	}
+	if (cullHierarchy && !batchedCulling && !visibleFirst) {
+		cullBVH(sceneModelPointers, sceneModelFlags);
+	} else {
+		//objects inside the view frustum are tested front to back, the others go to the end
+		frustumTestAll();
+		size_t frustumCount = sortScene();
+		if (visibleFirst) {
+			std::fill(sceneModelFlags.begin() + frustumCount, sceneModelFlags.end(), 0);
+			cullVisibleFirst(sceneModelPointers, frustumCount, sceneModelFlags);
+		} else if (batchedCulling) {
+			std::fill(sceneModelFlags.begin() + frustumCount, sceneModelFlags.end(), 0);
+			cullBatched(sceneModelPointers, frustumCount, (size_t)batchOccluders, sceneModelFlags);
+		} else {
+			for (size_t i = 0; i < modelCount; i++) {
+				sceneModelFlags[i] = 0;
+				if (i < frustumCount && shouldDraw(*sceneModelPointers[i])) {
+					sceneModelFlags[i] = 1;
+				}
+			}
 		}
 	}
 	std::chrono::high_resolution_clock::time_point cullEnd = std::chrono::high_resolution_clock::now();
@@ -519,7 +597,7 @@ void renderScene() {
 	//record stats: frame, drawn fraction, culling time
 	if (recordStats) {
 		std::chrono::duration<double, std::milli> cullTime = cullEnd - cullStart;
-		statsFile << "f " << currentFrame << " df " << (double)drawn / (double)sceneModelPointers.size() << " ct " << cullTime.count() <<  std::endl;
+		statsFile << "f " << currentFrame << " df " << (double)drawn / (double)sceneModelPointers.size() << " ct " << cullTime.count() << " so " << skippedOccluders << " st " << skippedTriangles << std::endl;
 	}
 
 	//draw cube at light source
@@ -540,6 +618,7 @@ double distSquaredToCamera(ModelCollection &m) {
 	glm::vec4 transformed = view * m.modelMatrix * glm::vec4(m.boxCenter, 1.0f);
 	glm::vec3 p = glm::vec3(transformed / transformed.a);
 	m.dist2ToCamera = ((double)p.x * (double)p.x) + ((double)p.y * (double)p.y) + ((double)p.z * (double)p.z);
+	m.lastSorted = currentFrame;
 
 	return m.dist2ToCamera;
 }
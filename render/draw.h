@@ -68,8 +68,12 @@ void makeAlternateScene();
 //load models for alternate scene
 void makeDefaultScene();
 
-//comparator for models based on depth -- use to sort scene by depth
-bool modelPointerComparator(ModelCollection* m1, ModelCollection* m2);
+//an object and its squared distance to the camera this frame -- objects are sorted front to back on these keys,
+//so each distance is computed once instead of twice per comparison
+struct SortEntry {
+	double key;
+	ModelCollection* m;
+};
 
 //render scene
 void renderScene();
@@ -15,6 +15,9 @@
 #include "draw.h"
 #include "control.h"
 #include "models.h"
+#include "simd.h"
+#include "threads.h"
+#include "bvh.h"
 
 //To load vertex and fragment shaders
 #include <common/shader.hpp>
@@ -22,6 +25,7 @@
 #include <ctime>
 #include <vector>
 #include <algorithm>
+#include <thread>
 
 //Stuff for file i/o
 #include <fstream>
@@ -78,14 +82,50 @@ void init() {
 	}
 }
 
+//read a whole number given on the command line into value -- false if the text isn't one
+static bool parseInt(const std::string& text, int& value) {
+	try {
+		size_t used;
+		value = std::stoi(text, &used);
+		return used == text.length();
+	} catch (const std::exception&) { //not a number, or out of range
+		return false;
+	}
+}
+
+//read a number given on the command line into value -- false if the text isn't one
+static bool parseDouble(const std::string& text, double& value) {
+	try {
+		size_t used;
+		value = std::stod(text, &used);
+		return used == text.length();
+	} catch (const std::exception&) {
+		return false;
+	}
+}
+
 //Main function...
 int main(int argc, char **argv) {
 	
 	//Parse command line arguments
 	replayMode = CONTROL;
+	int isa = detectISA(); //instruction set of the culling kernels -- widest supported one unless -isa is given
+	int threads = std::thread::hardware_concurrency(); //threads used for culling -- one per core unless -threads is given
+	int bufferWidth = DEFAULT_BUFFER_WIDTH; //size of depth buffer -- can be changed with -buffer and -block
+	int bufferHeight = DEFAULT_BUFFER_HEIGHT;
+	int blockWidth = DEFAULT_BLOCK_WIDTH;
+	int blockHeight = DEFAULT_BLOCK_HEIGHT;
 	for (int i = 1; i < argc; i++) {
 		std::string token = argv[i];
 
+		//these flags are followed by a value
+		if (token == "-isa" || token == "-threads" || token == "-buffer" || token == "-block" || token == "-budget" || token == "-timebudget" || token == "-batched") {
+			if (i + 1 >= argc) {
+				std::cerr << "Missing value after " << token << std::endl;
+				return -1;
+			}
+		}
+
 		if (token == "-r") {
 			replayMode = RECORD;
 		}
@@ -98,8 +138,118 @@ int main(int argc, char **argv) {
 		else if (token == "-a") {
 			sceneID = SCENE_ALTERNATE;
 		}
+		else if (token == "-isa" && i + 1 < argc) {
+			std::string name = argv[++i];
+			isa = isaFromName(name);
+			if (isa == -1) {
+				std::cerr << "Unknown instruction set " << name << " -- use scalar, sse41, avx2 or avx512" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-threads" && i + 1 < argc) {
+			if (!parseInt(argv[++i], threads)) {
+				std::cerr << "Thread count should be a whole number, like 4" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-buffer" && i + 1 < argc) { //given as widthxheight, like 720x512
+			std::vector<std::string> size = split(argv[++i], "x");
+			if (size.size() != 2 || !parseInt(size[0], bufferWidth) || !parseInt(size[1], bufferHeight)) {
+				std::cerr << "Buffer size should be given as widthxheight, like 720x512" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-block" && i + 1 < argc) { //given as height, or widthxheight like 64x8
+			std::vector<std::string> size = split(argv[++i], "x");
+			bool valid = false;
+			if (size.size() == 1) {
+				valid = parseInt(size[0], blockHeight);
+			}
+			else if (size.size() == 2) {
+				valid = parseInt(size[0], blockWidth) && parseInt(size[1], blockHeight);
+			}
+			if (!valid) {
+				std::cerr << "Block size should be given as height or widthxheight, like 8 or 64x8" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-flat") {
+			cullHierarchy = false;
+		}
+		else if (token == "-precise") {
+			preciseTest = true;
+		}
+		else if (token == "-shared") {
+			sharedRendering = true;
+		}
+		else if (token == "-keepdepths") {
+			keepDepths = true;
+		}
+		else if (token == "-visiblefirst") {
+			visibleFirst = true;
+		}
+		else if (token == "-budget" && i + 1 < argc) {
+			occluderBudget = true;
+			if (!parseInt(argv[++i], budgetTriangles)) {
+				std::cerr << "Occluder triangle budget should be a whole number, like 256" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-timebudget" && i + 1 < argc) {
+			timeBudget = true;
+			if (!parseDouble(argv[++i], budgetMicroseconds)) {
+				std::cerr << "Culling time budget should be a number of microseconds, like 300" << std::endl;
+				return -1;
+			}
+		}
+		else if (token == "-batched" && i + 1 < argc) {
+			batchedCulling = true;
+			if (!parseInt(argv[++i], batchOccluders)) {
+				std::cerr << "Number of batched occluders should be a whole number, like 8" << std::endl;
+				return -1;
+			}
+		}
 	}
 
+	//Make depth buffer
+	if (!supportedBlockWidth(blockWidth)) {
+		std::cerr << "Unsupported block width " << blockWidth << " -- use 32 or 64" << std::endl;
+		return -1;
+	}
+	if (!supportedBlockHeight(blockHeight)) {
+		std::cerr << "Unsupported block height " << blockHeight << " -- use 4, 8 or 16" << std::endl;
+		return -1;
+	}
+	if (bufferWidth <= 0 || bufferHeight <= 0) {
+		std::cerr << "Buffer size must be positive" << std::endl;
+		return -1;
+	}
+	if (batchOccluders < 0) {
+		std::cerr << "Number of batched occluders can't be negative" << std::endl;
+		return -1;
+	}
+	if (budgetTriangles < 0) {
+		std::cerr << "Occluder triangle budget can't be negative" << std::endl;
+		return -1;
+	}
+	if (budgetMicroseconds < 0.0) {
+		std::cerr << "Culling time budget can't be negative" << std::endl;
+		return -1;
+	}
+	if (bufferWidth != DEFAULT_BUFFER_WIDTH || bufferHeight != DEFAULT_BUFFER_HEIGHT || blockWidth != DEFAULT_BLOCK_WIDTH || blockHeight != DEFAULT_BLOCK_HEIGHT) {
+		dBuffer.resize(bufferWidth, bufferHeight, blockWidth, blockHeight);
+		if ((int)dBuffer.width != bufferWidth || (int)dBuffer.height != bufferHeight) {
+			std::cout << "Buffer size rounded up to whole blocks: " << dBuffer.width << "x" << dBuffer.height << std::endl;
+		}
+	}
+
+	//Choose culling kernels
+	int usedISA = selectISA(isa);
+	if (usedISA != isa) {
+		std::cout << "Instruction set " << isaName(isa) << " isn't supported by this CPU -- using " << isaName(usedISA) << " instead" << std::endl;
+	}
+	std::cout << "Culling kernels: " << isaName(usedISA) << std::endl;
+
 	//Initialize GLFW and make window
 	if (glfwInit() != GL_TRUE) {
 		std::cerr << "Failed to init glfw" << std::endl;
@@ -146,6 +296,10 @@ int main(int argc, char **argv) {
 
 	init();
 
+	//Start culling threads
+	startThreads(threads);
+	std::cout << "Culling threads: " << threadCount << std::endl;
+
 	//main loop
 	do {
 		recordedFrameNumber = false;
@@ -171,6 +325,7 @@ int main(int argc, char **argv) {
 		currentFrame++;
 	} while (!glfwWindowShouldClose(window));
 
+	stopThreads();
 	replayFile.close();
 	statsFile.close();
 	std::cout << "Ending on frame " << currentFrame << std::endl;
@@ -8,18 +8,14 @@ Model cube; //small cube used to show where the light source is
 Model::Model() {
 }
 
-//copy Model constructor
-Model::Model(const Model &m) {
-	this->varr = m.varr;
-	this->posBuff = m.posBuff;
-	this->colBuff = m.colBuff;
-	this->nVerts = m.nVerts;
-}
-
 //ModelCollection constructor
 ModelCollection::ModelCollection() {
 	lastSorted = 0;
 	dist2ToCamera = 0;
+	occluderStart = occluderCount = 0;
+	boundsIndex = 0;
+	doubleSided = false;
+	wasVisible = false;
 }
 
 //copy ModelCollection constructor
@@ -28,8 +24,13 @@ ModelCollection::ModelCollection(const ModelCollection &m) {
 	this->occluder = m.occluder;
 	this->box = m.box;
 	this->occluderData = m.occluderData;
+	this->doubleSided = m.doubleSided;
 	this->boxData = m.boxData;
 	this->modelMatrix = m.modelMatrix;
+	this->occluderStart = m.occluderStart;
+	this->occluderCount = m.occluderCount;
+	this->boundsIndex = m.boundsIndex;
+	this->wasVisible = m.wasVisible;
 	this->marker = m.marker;
 	this->lastSorted = m.lastSorted;
 	this->transformedCenter = m.transformedCenter;
@@ -144,7 +145,7 @@ Model parseObj(std::string fileName, GLfloat r, GLfloat g, GLfloat b, std::vecto
 
 
 //parse multiple obj files into a ModelCollection representing one object -- see header for details
-ModelCollection parseModelCollection(std::string mainFileName, GLfloat r, GLfloat g, GLfloat b, std::string occluderFileName, std::string boxFileName, std::string markerFileName) {
+ModelCollection parseModelCollection(std::string mainFileName, GLfloat r, GLfloat g, GLfloat b, std::string occluderFileName, std::string boxFileName, std::string markerFileName, bool doubleSided) {
 	ModelCollection m;
 
 	m.main = parseObj(mainFileName, r, g, b);
@@ -152,6 +153,7 @@ ModelCollection parseModelCollection(std::string mainFileName, GLfloat r, GLfloa
 	m.box = parseObj(boxFileName, 1.0f, 1.0f, 0.0f, m.boxData); //save bounding box data for depth buffer tests
 	m.boxCenter = modelDataCenter(m.boxData); //get center of bounding box for sorting objects by depth later
 	m.marker = parseObj(markerFileName, 0.0f, 1.0f, 1.0f); //marker to show object in scene (to illustrate occlusion effect)
+	m.doubleSided = doubleSided;
 
 	return m;
 }
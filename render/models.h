@@ -23,8 +23,6 @@ struct Model {
 	int nVerts; //number of vertices in model
 
 	Model();
-
-	Model(const Model& m); //copy constructor
 };
 
 extern Model cube; //used to show where the light source is
@@ -38,6 +36,7 @@ struct ModelCollection {
 
 	Model occluder; //occluder model to draw in GL
 	std::vector<GLfloat> occluderData; //raw occluder data (for rendering into depth buffer)
+	bool doubleSided; //occluder isn't closed, so its back faces can be seen too -- otherwise they're dropped before rasterizing
 	
 	Model box; //bounding box mesh to render in GL
 	std::vector<GLfloat> boxData; //raw box data (for depth test in depth buffer)
@@ -47,6 +46,11 @@ struct ModelCollection {
 
 	glm::mat4 modelMatrix; //model matrix for this object
 
+	//range of points of the occluder in worldPoints, and index of bounding box in worldBounds (see bakeScene in cull.h)
+	uint32_t occluderStart, occluderCount;
+	uint32_t boundsIndex;
+
+	bool wasVisible; //was this object drawn last frame? (see cullVisibleFirst in cull.h)
 
 	uint64_t lastSorted; //frame that this object's center was last transformed on
 	glm::vec3 transformedCenter; //center transformed for this frame
@@ -75,10 +79,11 @@ Model parseObj(std::string fileName, GLfloat r, GLfloat g, GLfloat b, std::vecto
 	occluderFileName -- file name of the occlusion mesh
 	boxFileName -- file name of the bounding box of the main mesh
 	markerFileName -- file name of the marker for the main mesh (this should be a very tall, thin pillar positioned somewhere near the center of the main mesh)
+	doubleSided -- true if the occlusion mesh isn't closed (like a single wall or a sign), so its back faces are kept when rasterizing
 
 
 */
-ModelCollection parseModelCollection(std::string mainFileName, GLfloat r, GLfloat g, GLfloat b, std::string occluderFileName, std::string boxFileName, std::string markerFileName);
+ModelCollection parseModelCollection(std::string mainFileName, GLfloat r, GLfloat g, GLfloat b, std::string occluderFileName, std::string boxFileName, std::string markerFileName, bool doubleSided = false);
 
 /*	given coordinate data for a model, return the center point
 */
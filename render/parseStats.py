@@ -5,6 +5,10 @@
     f -- frame number (this is automatically put on the x axis
     df -- "drawn fraction", fraction of objects drawn in a frame
     ct -- "culling time", milliseconds that culling logic took this frame
+    so -- "skipped occluders", occluders not rendered this frame because the -timebudget ran out
+    st -- "skipped triangles", triangles not rendered this frame because the -timebudget ran out: all triangles of
+          the skipped occluders, plus those left out of occluders cut off partway (left out of any of their bins when
+          threads render an occluder together)
 
 """
 
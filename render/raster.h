@@ -0,0 +1,196 @@
+#pragma once
+
+/*		raster file
+
+	the parts of the rasterizer that turn a set up triangle (see setupTriangle in cull.h) into events and blocks:
+	walking its edges down the scanlines, working out which blocks of a row it misses, touches or covers, and the depth
+	it's given in each block
+
+	these are only used by cull.cpp -- they're kept here so the tests can check them against a per-pixel reference
+*/
+
+#include "cull.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+//ceil(n / d) for d > 0 -- division rounds towards 0, which is already the ceiling for negative n
+static inline int64_t ceilDiv(int64_t n, int64_t d) {
+	int64_t c = n / d;
+	return c + (c * d < n ? 1 : 0);
+}
+
+//floor(n / d) for d > 0
+static inline int64_t floorDiv(int64_t n, int64_t d) {
+	int64_t c = n / d;
+	return c - (c * d > n ? 1 : 0);
+}
+
+/*	walking an edge down the scanlines -- see EdgeSetup
+
+	x is the event on the current scanline, and s what's missing from its numerator to the next multiple of d
+	(0 <= s < d) -- going down a scanline takes r off s, and once s goes below 0, d is added back and x moves
+	one more pixel, so there are no divisions past the first scanline
+*/
+struct EdgeWalk {
+	int64_t x;
+	int64_t s;
+
+	//start at scanline y
+	void start(const EdgeSetup& e, int y) {
+		int64_t n = e.n + y * e.r;
+		int64_t c = ceilDiv(n, e.d);
+		s = c * e.d - n;
+		x = y * e.q + c;
+	}
+
+	//event on the current scanline, and go down to the next one
+	inline int64_t next(const EdgeSetup& e) {
+		int64_t event = x;
+		s -= e.r;
+		int64_t carry = s >> 63; //all 1s if s went below 0
+		s += e.d & carry;
+		x += e.q - carry;
+		return event;
+	}
+
+	//true if the events of the next count scanlines are all within +-EVENT_FAR
+	bool staysNear(const EdgeSetup& e, int count) const {
+		return std::abs(x) + (std::abs(e.q) + 1) * count <= EVENT_FAR;
+	}
+};
+
+//event as given to the kernels -- events further out than EVENT_FAR are all the same to them
+static inline int32_t clampEvent(int64_t x) {
+	return (int32_t)std::min(std::max(x, (int64_t)-EVENT_FAR), (int64_t)EVENT_FAR);
+}
+
+/*	the edges of a set up triangle, walked down the scanlines together
+
+	on scanlines the triangle doesn't cover, the first edge gets an event that leaves them empty
+*/
+struct TriangleWalk {
+	EdgeWalk w1, w2, w3;
+	int y; //scanline of the next events
+
+	TriangleWalk() : y(-1) {}
+
+	//start at scanline y -- this takes a division per edge, so it's cheaper to carry on walking when the next scanlines are wanted
+	void start(const TriangleSetup& t, int y) {
+		w1.start(t.edge1, y);
+		w2.start(t.edge2, y);
+		w3.start(t.edge3, y);
+		this->y = y;
+	}
+
+	//events of each edge on the next count scanlines
+	void events(const TriangleSetup& t, int count, int32_t* e1x, int32_t* e2x, int32_t* e3x) {
+		//the three edges are walked side by side, so their carries don't wait on each other
+		//the events only need clamping if an edge gets far from the buffer, which is checked once up front
+		if (w1.staysNear(t.edge1, count) && w2.staysNear(t.edge2, count) && w3.staysNear(t.edge3, count)) {
+			for (int k = 0; k < count; k++) {
+				e1x[k] = (int32_t)w1.next(t.edge1);
+				e2x[k] = (int32_t)w2.next(t.edge2);
+				e3x[k] = (int32_t)w3.next(t.edge3);
+			}
+		} else {
+			for (int k = 0; k < count; k++) {
+				e1x[k] = clampEvent(w1.next(t.edge1));
+				e2x[k] = clampEvent(w2.next(t.edge2));
+				e3x[k] = clampEvent(w3.next(t.edge3));
+			}
+		}
+
+		if (y < t.yStart || y + count - 1 > t.yEnd) {
+			int32_t empty = t.mask1 ? -EVENT_FAR : EVENT_FAR;
+			for (int k = 0; k < count; k++) {
+				if (y + k < t.yStart || y + k > t.yEnd) {
+					e1x[k] = empty;
+				}
+			}
+		}
+		y += count;
+	}
+};
+
+/*	blocks of a row a triangle can touch, worked out from its events on the row's scanlines
+
+	a triangle covers pixels left..right - 1 of a scanline, where left is the largest event of its left edges and right
+	the smallest event of its right edges (an edge is a right edge if its mask is set, see line())
+	blocks outside of first..last are missed on every scanline of the row, and blocks fullStart..fullEnd are covered on
+	all of them, so only the blocks in between need masks
+
+	the events of an edge only ever go one way down the scanlines, so only the first and last scanline the triangle covers
+	in the row are looked at -- first..last can then include a few blocks that are missed after all, but never leaves
+	out one that isn't, and fullStart..fullEnd is exact
+*/
+struct RowCoverage {
+	int first, last; //blocks the triangle might touch -- empty if first > last
+	int fullStart, fullEnd; //blocks the triangle covers entirely -- empty if fullStart > fullEnd
+
+	//y is the top scanline of the row, and e1x, e2x, e3x the events from there on
+	template<int WIDTH, int HEIGHT>
+	void classify(const TriangleSetup& t, int y, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x) {
+		//scanlines of the row the triangle covers
+		int k0 = std::max(t.yStart - y, 0);
+		int k1 = std::min(t.yEnd - y, HEIGHT - 1);
+		if (k0 > k1) {
+			first = fullStart = 0;
+			last = fullEnd = -1;
+			return;
+		}
+
+		int32_t unionLeft = -EVENT_FAR, unionRight = EVENT_FAR; //no pixel outside of these is covered on any scanline
+		int32_t maxLeft = -EVENT_FAR, minRight = EVENT_FAR; //every pixel between these is covered on every scanline
+		limit(t.mask1, e1x[k0], e1x[k1], unionLeft, unionRight, maxLeft, minRight);
+		limit(t.mask2, e2x[k0], e2x[k1], unionLeft, unionRight, maxLeft, minRight);
+		limit(t.mask3, e3x[k0], e3x[k1], unionLeft, unionRight, maxLeft, minRight);
+
+		first = (int)floorDiv(unionLeft, WIDTH);
+		last = (int)floorDiv(unionRight - 1, WIDTH);
+		fullStart = (int)ceilDiv(maxLeft, WIDTH);
+		fullEnd = k0 == 0 && k1 == HEIGHT - 1 ? (int)floorDiv(minRight, WIDTH) - 1 : fullStart - 1;
+	}
+
+private:
+	//narrow the limits by an edge with events a and b on the first and last scanline
+	static inline void limit(uint32_t flip, int32_t a, int32_t b, int32_t& unionLeft, int32_t& unionRight, int32_t& maxLeft, int32_t& minRight) {
+		int32_t low = std::min(a, b);
+		int32_t high = std::max(a, b);
+		if (flip) {
+			unionRight = std::min(unionRight, high);
+			minRight = std::min(minRight, low);
+		} else {
+			unionLeft = std::max(unionLeft, low);
+			maxLeft = std::max(maxLeft, high);
+		}
+	}
+};
+
+/*	depths of a triangle within the blocks of a row, from its depth plane
+
+	the deepest point of the plane within block j is at one of the block's corners -- the scanlines are cut down to the
+	ones the triangle covers, so near its top and bottom points the plane isn't followed past them
+	the kernels add up the depths of a run of blocks in floats (see simd.h), so the start is pushed a little deeper to
+	make up for their rounding -- the depths given out are never nearer than the plane
+*/
+template<int WIDTH, int HEIGHT>
+struct RowDepths {
+	double base; //deepest point of the plane within block 0
+	double step; //from one block to the next
+
+	void start(const TriangleSetup& t, int i) {
+		double yFar = t.zy > 0.0 ? std::min((i + 1) * HEIGHT, t.yEnd + 1) : std::max(i * HEIGHT, t.yStart);
+		base = t.z0 + t.zy * yFar + (t.zx > 0.0 ? t.zx * WIDTH : 0.0);
+		step = t.zx * WIDTH;
+	}
+
+	//maxZStart and maxZStep for the kernels, for blocks jStart..jEnd
+	void run(int jStart, int jEnd, GLfloat& maxZStart, GLfloat& maxZStep) const {
+		double start = base + jStart * step;
+		double count = jEnd - jStart + 1;
+		double rounding = (count + 2.0) * (std::fabs(start) + count * std::fabs(step)) * (1.0 / (1 << 22));
+		maxZStart = (GLfloat)(start + rounding);
+		maxZStep = (GLfloat)step;
+	}
+};
@@ -0,0 +1,168 @@
+#include "simd.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+int cullISA = ISA_SCALAR;
+
+template<int WIDTH, int HEIGHT>
+RenderRowFunction<WIDTH, HEIGHT> Kernels<WIDTH, HEIGHT>::renderRow = renderRowScalar<WIDTH, HEIGHT>;
+
+template struct Kernels<32, 4>;
+template struct Kernels<32, 8>;
+template struct Kernels<32, 16>;
+template struct Kernels<64, 4>;
+template struct Kernels<64, 8>;
+template struct Kernels<64, 16>;
+
+//render kernels of each instruction set for blocks of WIDTH x HEIGHT pixels, indexed by isaEnum
+template<int WIDTH, int HEIGHT>
+struct KernelTable {
+	RenderRowFunction<WIDTH, HEIGHT> renderRow[ISA_COUNT];
+};
+
+//blocks of 4 scanlines fill only half an AVX2 register, so the SSE4.1 kernel renders them
+static const KernelTable<32, 4> kernels32x4 = {
+	{ renderRowScalar<32, 4>, renderRowSSE41<4>, renderRowSSE41<4>, renderRowSSE41<4> }
+};
+static const KernelTable<32, 8> kernels32x8 = {
+	{ renderRowScalar<32, 8>, renderRowSSE41<8>, renderRowAVX2<8>, renderRowAVX512<8> }
+};
+//a block of 16 scanlines fills a whole AVX-512 register, which the AVX2 kernel already does in two steps
+static const KernelTable<32, 16> kernels32x16 = {
+	{ renderRowScalar<32, 16>, renderRowSSE41<16>, renderRowAVX2<16>, renderRowAVX2<16> }
+};
+
+//an SSE4.1 register holds only 2 scanlines of a block 64 pixels wide, which isn't worth it -- the scalar kernel renders them
+//a block of 4 such scanlines fills an AVX2 register, so AVX-512 has nothing to add for it
+static const KernelTable<64, 4> kernels64x4 = {
+	{ renderRowScalar<64, 4>, renderRowScalar<64, 4>, renderRowAVX2<4>, renderRowAVX2<4> }
+};
+static const KernelTable<64, 8> kernels64x8 = {
+	{ renderRowScalar<64, 8>, renderRowScalar<64, 8>, renderRowAVX2<8>, renderRowAVX512<8> }
+};
+static const KernelTable<64, 16> kernels64x16 = {
+	{ renderRowScalar<64, 16>, renderRowScalar<64, 16>, renderRowAVX2<16>, renderRowAVX512<16> }
+};
+
+TestRowFunction testRow = testRowScalar;
+static const TestRowFunction testRowKernels[ISA_COUNT] = { testRowScalar, testRowSSE41, testRowAVX2, testRowAVX512 };
+
+ProjectBoxFunction projectBox = projectBoxScalar;
+
+//the 8 corners of a box fill one AVX2 register, so AVX-512 has nothing to add
+static const ProjectBoxFunction projectBoxKernels[ISA_COUNT] = { projectBoxScalar, projectBoxSSE41, projectBoxAVX2, projectBoxAVX2 };
+
+FrustumTestFunction frustumTestKernel = frustumTestScalar;
+static const FrustumTestFunction frustumTestKernels[ISA_COUNT] = { frustumTestScalar, frustumTestSSE41, frustumTestAVX2, frustumTestAVX512 };
+
+//test boxes with the frustum kernel in use -- see header
+void frustumTest(const WorldBoxes& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside) {
+	BoxArrays arrays = { boxes.minX.data(), boxes.minY.data(), boxes.minZ.data(), boxes.maxX.data(), boxes.maxY.data(), boxes.maxZ.data() };
+	frustumTestKernel(arrays, start, end, planes, inside);
+}
+
+static const char* isaNames[ISA_COUNT] = { "scalar", "sse41", "avx2", "avx512" };
+
+//cpuid with leaf and subleaf -- registers are written to r as eax, ebx, ecx, edx
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t r[4]) {
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuidex(regs, leaf, subleaf);
+	for (int i = 0; i < 4; i++) {
+		r[i] = (uint32_t)regs[i];
+	}
+#else
+	if (!__get_cpuid_count(leaf, subleaf, &r[0], &r[1], &r[2], &r[3])) {
+		r[0] = r[1] = r[2] = r[3] = 0;
+	}
+#endif
+}
+
+//register state the OS saves on context switches (XCR0)
+static uint64_t xgetbv0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+//widest instruction set supported by this CPU and OS -- see header
+int detectISA() {
+	uint32_t r[4];
+	cpuid(0, 0, r);
+	uint32_t maxLeaf = r[0];
+
+	cpuid(1, 0, r);
+	bool sse41 = (r[2] & (1 << 19)) != 0;
+	bool osxsave = (r[2] & (1 << 27)) != 0;
+	bool avx = (r[2] & (1 << 28)) != 0;
+	if (!sse41) {
+		return ISA_SCALAR;
+	}
+
+	//the OS must save the YMM (and for AVX-512, the ZMM and mask) registers, or using them isn't safe
+	uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if (maxLeaf >= 7) {
+		cpuid(7, 0, r);
+		avx2 = (r[1] & (1 << 5)) != 0;
+		avx512 = (r[1] & (1 << 16)) != 0; //AVX-512F
+	}
+
+	if (avx && avx2 && avx512 && ymmState && zmmState) {
+		return ISA_AVX512;
+	}
+	if (avx && avx2 && ymmState) {
+		return ISA_AVX2;
+	}
+	return ISA_SSE41;
+}
+
+//name of instruction set -- see header
+const char* isaName(int isa) {
+	if (isa < 0 || isa >= ISA_COUNT) {
+		return "unknown";
+	}
+	return isaNames[isa];
+}
+
+//instruction set from name -- see header
+int isaFromName(const std::string& name) {
+	for (int i = 0; i < ISA_COUNT; i++) {
+		if (name == isaNames[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+//switch kernels to this instruction set, or the widest supported one -- see header
+int selectISA(int isa) {
+	int supported = detectISA();
+	if (isa < 0 || isa > supported) {
+		isa = supported;
+	}
+
+	cullISA = isa;
+	Kernels<32, 4>::renderRow = kernels32x4.renderRow[isa];
+	Kernels<32, 8>::renderRow = kernels32x8.renderRow[isa];
+	Kernels<32, 16>::renderRow = kernels32x16.renderRow[isa];
+	Kernels<64, 4>::renderRow = kernels64x4.renderRow[isa];
+	Kernels<64, 8>::renderRow = kernels64x8.renderRow[isa];
+	Kernels<64, 16>::renderRow = kernels64x16.renderRow[isa];
+	testRow = testRowKernels[isa];
+	projectBox = projectBoxKernels[isa];
+	frustumTestKernel = frustumTestKernels[isa];
+	return isa;
+}
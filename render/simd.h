@@ -0,0 +1,149 @@
+#pragma once
+
+/*		simd file
+
+	SIMD versions of the innermost loops of the culling logic, and the runtime
+	selection of which versions to use
+
+	the row kernels do the work of the scalar loop in renderIntoDepthBuffer for one row of blocks:
+	all scanline masks of a block are computed at once with vector shifts, and the
+	"mask is full" check of the depth buffer update is done with vector compares -- blocks 64 pixels
+	wide use 64 bit shifts, with half as many scanlines per vector
+
+	the test kernels do the reference depth comparison of depthTest for one row of blocks
+
+	the box kernels project the 8 corners of an object's bounding box for the depth test
+
+	the frustum kernels test the world space boxes of many objects against the view frustum at once
+
+	every kernel gives exactly the same results as the scalar version, which is the reference -- where two depths are
+	equal, the kernels pick the same one as std::min and std::max do, so even the sign of a zero depth matches
+
+	the files implementing these kernels are compiled with their instruction set enabled (see CMakeLists.txt),
+	so they should only include what they need -- anything with a static initializer (like iostream)
+	would be compiled with that instruction set too, and would run on every machine at startup
+
+	for the same reason they work on plain pointers instead of calling inline functions of templates shared with
+	other files, like glm's operator[] or std::vector's -- unoptimized builds keep those as functions in every file
+	that uses them, and the linker picks one copy for the whole program, which may be the one using the wider
+	instructions
+*/
+
+#include "cull.h"
+
+//instruction sets the culling kernels are available for -- each one needs the ones before it
+enum isaEnum { ISA_SCALAR = 0, ISA_SSE41 = 1, ISA_AVX2 = 2, ISA_AVX512 = 3, ISA_COUNT = 4 };
+extern int cullISA; //instruction set of the kernels currently in use
+
+/*	rasterize one triangle into a row of blocks and update the depths of those blocks
+
+	row -- the row of blocks, starting at x = 0 -- the blocks jStart..jEnd must have been cleared this frame (see DepthBuffer::touch)
+	jStart, jEnd -- range of blocks of the row to render into (inclusive)
+	e1x, e2x, e3x -- events of each triangle edge on the HEIGHT scanlines of this row (the first pixel right of
+	the edge, see EdgeSetup)
+	o1, o2, o3 -- masks used to flip the edges, as given to line() (0 or ~0, they're widened for blocks 64 pixels wide)
+	minZ -- depth of nearest point of triangle -- blocks with a nearer reference depth are skipped, since the triangle is behind them
+	maxZ -- depth of farthest point of triangle
+	maxZStart, maxZStep -- the triangle's depth within block jStart (from its depth plane, see RowDepths in raster.h),
+	and how much it grows from one block to the next -- it's added up block by block, without multiplying, so every
+	kernel gets exactly the same depths -- the depth merged into a block is the nearer of this and maxZ
+
+	returns true if the reference depth of any block was updated
+*/
+template<int WIDTH, int HEIGHT>
+using RenderRowFunction = bool (*)(BlockRow<WIDTH, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+
+/*	true if any block in jStart..jEnd of a row of blocks has a reference depth >= minZ
+
+	reference -- reference depths of the row of blocks, starting at x = 0
+	the reference depths are packed, so this is the same for every block height
+*/
+typedef bool (*TestRowFunction)(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ);
+
+//kernels currently in use for blocks of WIDTH x HEIGHT pixels -- set by selectISA for every supported block size
+template<int WIDTH, int HEIGHT>
+struct Kernels {
+	static RenderRowFunction<WIDTH, HEIGHT> renderRow;
+};
+
+extern TestRowFunction testRow; //test kernel currently in use -- set by selectISA
+
+/*	project the corners of a bounding box with the view-projection matrix m, and get their bounding square in NDC space
+
+	returns false, without a bounding square, if any corner is behind the near plane -- the box then covers the
+	whole screen as far as culling is concerned
+*/
+typedef bool (*ProjectBoxFunction)(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ);
+
+extern ProjectBoxFunction projectBox; //box kernel currently in use -- set by selectISA
+
+//the arrays of a WorldBoxes as plain pointers, for the frustum kernels (see the top of this file)
+struct BoxArrays {
+	const GLfloat *minX, *minY, *minZ;
+	const GLfloat *maxX, *maxY, *maxZ;
+};
+
+/*	test boxes start..end - 1 of boxes against the 6 frustum planes (xyz is the inward normal, w the offset)
+
+	inside[i] is set to 1 if box i is at least partly inside all planes, or 0 if it's entirely outside one of them
+*/
+typedef void (*FrustumTestFunction)(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside);
+
+extern FrustumTestFunction frustumTestKernel; //frustum kernel currently in use -- set by selectISA
+
+//test boxes start..end - 1 of boxes with the frustum kernel in use
+void frustumTest(const WorldBoxes& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside);
+
+//widest instruction set supported by this CPU and OS (uses cpuid)
+int detectISA();
+
+//name of instruction set as used on the command line (scalar, sse41, avx2, avx512)
+const char* isaName(int isa);
+
+//instruction set with this name, or -1 if there is none
+int isaFromName(const std::string& name);
+
+/*	use the kernels of this instruction set
+
+	if the CPU doesn't support it, the widest supported instruction set is used instead
+	returns the instruction set that is used
+
+	where an instruction set has no kernel for a block size, the one of the next narrower instruction set is used
+*/
+int selectISA(int isa);
+
+//the render kernels are templates on the block size, and are compiled (explicitly instantiated) in their own files
+//for the sizes they support -- the SIMD ones have an overload for each block width
+
+//scalar kernels (cull.cpp) -- all block sizes
+template<int WIDTH, int HEIGHT>
+bool renderRowScalar(BlockRow<WIDTH, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+bool testRowScalar(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ);
+bool projectBoxScalar(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ);
+void frustumTestScalar(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside);
+
+//SSE4.1 kernels -- work on 4 scanlines/blocks at a time, rendering needs blocks 32 pixels wide (any height)
+template<int HEIGHT>
+bool renderRowSSE41(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+bool testRowSSE41(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ);
+bool projectBoxSSE41(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ);
+void frustumTestSSE41(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside); //4 boxes at a time
+
+//AVX2 kernels -- work on 8 scanlines/blocks at a time, rendering needs blocks 8 or 16 pixels high
+//(or 4 scanlines at a time for blocks 64 pixels wide, any height)
+template<int HEIGHT>
+bool renderRowAVX2(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+template<int HEIGHT>
+bool renderRowAVX2(BlockRow<64, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+bool testRowAVX2(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ);
+bool projectBoxAVX2(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ); //all 8 corners at once, also used for AVX-512
+void frustumTestAVX2(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside); //8 boxes at a time
+
+//AVX-512 kernels -- work on 16 scanlines/blocks at a time (two blocks per vector when rendering), rendering needs blocks 8 pixels high
+//(or 8 scanlines at a time for blocks 64 pixels wide, 8 or 16 pixels high)
+template<int HEIGHT>
+bool renderRowAVX512(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+template<int HEIGHT>
+bool renderRowAVX512(BlockRow<64, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep);
+bool testRowAVX512(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ);
+void frustumTestAVX512(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside); //16 boxes at a time
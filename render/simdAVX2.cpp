@@ -0,0 +1,251 @@
+#include "simd.h"
+#include <immintrin.h>
+
+//rasterize triangle into a row of blocks using AVX2 -- see header for details
+template<int HEIGHT>
+bool renderRowAVX2(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	static_assert(HEIGHT % 8 == 0, "AVX2 kernels work on 8 scanlines at a time");
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i width = _mm256_set1_epi32(32);
+	const __m256i ones = _mm256_set1_epi32(~0);
+
+	//edge flip masks
+	const __m256i flip1 = _mm256_set1_epi32(o1);
+	const __m256i flip2 = _mm256_set1_epi32(o2);
+	const __m256i flip3 = _mm256_set1_epi32(o3);
+
+	bool updated = false; //was any reference depth updated?
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		uint32_t* mask = row.bits + j * HEIGHT; //masks of this block
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = maxZ < maxZStart ? maxZ : maxZStart; //depth of triangle within this block
+		maxZStart += maxZStep;
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block
+		}
+		__m256i blockX = _mm256_set1_epi32(j * 32); //x coordinate of block in pixel space
+
+		//heuristic to throw away working layer (same as the scalar version) -- done by clearing the masks below
+		GLfloat dist1t = working - blockMaxZ;
+		GLfloat dist01 = reference - working;
+		bool discard = dist1t > dist01;
+		__m256i keep = discard ? _mm256_setzero_si256() : ones;
+		if (discard) {
+			working = 0.0f;
+		}
+
+		//merge triangle into working layer
+		working = working < blockMaxZ ? blockMaxZ : working;
+
+		__m256i full = ones; //lanes stay all 1s while their scanlines are full
+		for (int k = 0; k < HEIGHT; k += 8) {
+			//x coordinates of events relative to this block, clamped to [0, 32] -- a shift by 32 gives an empty mask, like in line()
+			__m256i e1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e1x + k)), blockX), zero), width);
+			__m256i e2 = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e2x + k)), blockX), zero), width);
+			__m256i e3 = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e3x + k)), blockX), zero), width);
+
+			//masks of 8 scanlines at once -- this is line() with a variable shift per lane
+			__m256i m1 = _mm256_xor_si256(_mm256_srlv_epi32(ones, e1), flip1);
+			__m256i m2 = _mm256_xor_si256(_mm256_srlv_epi32(ones, e2), flip2);
+			__m256i m3 = _mm256_xor_si256(_mm256_srlv_epi32(ones, e3), flip3);
+			__m256i result = _mm256_and_si256(m1, _mm256_and_si256(m2, m3));
+
+			__m256i* bits = (__m256i*) (mask + k);
+			__m256i merged = _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(bits), keep), result);
+			_mm256_storeu_si256(bits, merged);
+
+			full = _mm256_and_si256(full, _mm256_cmpeq_epi32(merged, ones));
+		}
+
+		//update reference layer if mask is full
+		if (_mm256_movemask_epi8(full) == -1) {
+			reference = working < reference ? working : reference;
+			working = 0.0f;
+			updated = true;
+			for (int k = 0; k < HEIGHT; k += 8) {
+				_mm256_storeu_si256((__m256i*) (mask + k), _mm256_setzero_si256());
+			}
+		}
+	}
+	return updated;
+}
+
+//rasterize triangle into a row of blocks 64 pixels wide using AVX2, 4 scanlines at a time -- see header for details
+template<int HEIGHT>
+bool renderRowAVX2(BlockRow<64, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	static_assert(HEIGHT % 4 == 0, "AVX2 kernels work on 4 scanlines of 64 pixels at a time");
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i width = _mm_set1_epi32(64);
+	const __m256i ones = _mm256_set1_epi64x(~0LL);
+
+	//edge flip masks, widened to 64 bits
+	const __m256i flip1 = _mm256_set1_epi64x((int64_t)(int32_t)o1);
+	const __m256i flip2 = _mm256_set1_epi64x((int64_t)(int32_t)o2);
+	const __m256i flip3 = _mm256_set1_epi64x((int64_t)(int32_t)o3);
+
+	bool updated = false; //was any reference depth updated?
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		uint64_t* mask = row.bits + j * HEIGHT; //masks of this block
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = maxZ < maxZStart ? maxZ : maxZStart; //depth of triangle within this block
+		maxZStart += maxZStep;
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block
+		}
+		__m128i blockX = _mm_set1_epi32(j * 64); //x coordinate of block in pixel space
+
+		//heuristic to throw away working layer (same as the scalar version) -- done by clearing the masks below
+		GLfloat dist1t = working - blockMaxZ;
+		GLfloat dist01 = reference - working;
+		bool discard = dist1t > dist01;
+		__m256i keep = discard ? _mm256_setzero_si256() : ones;
+		if (discard) {
+			working = 0.0f;
+		}
+
+		//merge triangle into working layer
+		working = working < blockMaxZ ? blockMaxZ : working;
+
+		__m256i full = ones; //lanes stay all 1s while their scanlines are full
+		for (int k = 0; k < HEIGHT; k += 4) {
+			//x coordinates of events relative to this block, clamped to [0, 64] and widened to 64 bits -- a shift by 64 gives an empty mask, like in line()
+			__m256i e1 = _mm256_cvtepu32_epi64(_mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e1x + k)), blockX), zero), width));
+			__m256i e2 = _mm256_cvtepu32_epi64(_mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e2x + k)), blockX), zero), width));
+			__m256i e3 = _mm256_cvtepu32_epi64(_mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e3x + k)), blockX), zero), width));
+
+			//masks of 4 scanlines at once
+			__m256i m1 = _mm256_xor_si256(_mm256_srlv_epi64(ones, e1), flip1);
+			__m256i m2 = _mm256_xor_si256(_mm256_srlv_epi64(ones, e2), flip2);
+			__m256i m3 = _mm256_xor_si256(_mm256_srlv_epi64(ones, e3), flip3);
+			__m256i result = _mm256_and_si256(m1, _mm256_and_si256(m2, m3));
+
+			__m256i* bits = (__m256i*) (mask + k);
+			__m256i merged = _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(bits), keep), result);
+			_mm256_storeu_si256(bits, merged);
+
+			full = _mm256_and_si256(full, _mm256_cmpeq_epi64(merged, ones));
+		}
+
+		//update reference layer if mask is full
+		if (_mm256_movemask_epi8(full) == -1) {
+			reference = working < reference ? working : reference;
+			working = 0.0f;
+			updated = true;
+			for (int k = 0; k < HEIGHT; k += 4) {
+				_mm256_storeu_si256((__m256i*) (mask + k), _mm256_setzero_si256());
+			}
+		}
+	}
+	return updated;
+}
+
+//true if any block of the row has reference >= minZ, using AVX2 -- see header for details
+bool testRowAVX2(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ) {
+	const __m256 z = _mm256_set1_ps(minZ);
+
+	int j = jStart;
+	for (; j + 7 <= jEnd; j += 8) {
+		if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(reference + j), z, _CMP_GE_OQ)) != 0) {
+			return true;
+		}
+	}
+
+	for (; j <= jEnd; j++) { //leftover blocks
+		if (reference[j] >= minZ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//one row of a matrix times 8 points -- added up like glm does, so the results are exactly the same as the scalar version
+static inline __m256 transformRow(const GLfloat* m, int r, __m256 x, __m256 y, __m256 z) {
+	__m256 xy = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[r]), x), _mm256_mul_ps(_mm256_set1_ps(m[4 + r]), y));
+	__m256 zw = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[8 + r]), z), _mm256_set1_ps(m[12 + r]));
+	return _mm256_add_ps(xy, zw);
+}
+
+//min and max of the 8 lanes
+static inline GLfloat horizontalMin(__m256 v) {
+	__m128 h = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+	h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(h);
+}
+static inline GLfloat horizontalMax(__m256 v) {
+	__m128 h = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	h = _mm_max_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+	h = _mm_max_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(h);
+}
+
+//project corners of a bounding box using AVX2, all 8 corners at once -- see header for details
+bool projectBoxAVX2(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ) {
+	const GLfloat* mat = reinterpret_cast<const GLfloat*>(&m); //column major -- not &m[0][0], see simd.h
+	__m256 x = _mm256_loadu_ps(b.cornerX);
+	__m256 y = _mm256_loadu_ps(b.cornerY);
+	__m256 z = _mm256_loadu_ps(b.cornerZ);
+
+	__m256 cx = transformRow(mat, 0, x, y, z);
+	__m256 cy = transformRow(mat, 1, x, y, z);
+	__m256 cz = transformRow(mat, 2, x, y, z);
+	__m256 cw = transformRow(mat, 3, x, y, z);
+
+	//corner behind the near plane (z < -w)
+	if (_mm256_movemask_ps(_mm256_cmp_ps(cz, _mm256_sub_ps(_mm256_setzero_ps(), cw), _CMP_LT_OQ)) != 0) {
+		return false;
+	}
+
+	__m256 nx = _mm256_div_ps(cx, cw);
+	__m256 ny = _mm256_div_ps(cy, cw);
+	__m256 nz = _mm256_div_ps(cz, cw);
+
+	minX = horizontalMin(nx);
+	maxX = horizontalMax(nx);
+	minY = horizontalMin(ny);
+	maxY = horizontalMax(ny);
+	minZ = horizontalMin(nz);
+	maxZ = horizontalMax(nz);
+	return true;
+}
+
+//test boxes against the frustum planes using AVX2, 8 boxes at a time -- see header for details
+void frustumTestAVX2(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside) {
+	int i = start;
+	for (; i + 7 < end; i += 8) {
+		__m256 outside = _mm256_setzero_ps(); //lanes become all 1s once their box is outside a plane
+		for (int k = 0; k < 6; k++) {
+			const glm::vec4& p = planes[k];
+
+			//corners of the boxes farthest along the plane normal -- if one is outside, its whole box is
+			__m256 px = _mm256_loadu_ps(p.x > 0.0f ? &boxes.maxX[i] : &boxes.minX[i]);
+			__m256 py = _mm256_loadu_ps(p.y > 0.0f ? &boxes.maxY[i] : &boxes.minY[i]);
+			__m256 pz = _mm256_loadu_ps(p.z > 0.0f ? &boxes.maxZ[i] : &boxes.minZ[i]);
+
+			//distances to the plane, added up in the same order as the scalar version
+			__m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.x), px), _mm256_mul_ps(_mm256_set1_ps(p.y), py));
+			d = _mm256_add_ps(_mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.z), pz)), _mm256_set1_ps(p.w));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(outside);
+		for (int b = 0; b < 8; b++) {
+			inside[i + b] = (mask >> b) & 1 ? 0 : 1;
+		}
+	}
+
+	frustumTestScalar(boxes, i, end, planes, inside); //leftover boxes
+}
+
+//kernels for the supported block sizes -- rendering works on 8 scanlines at a time, so blocks 32 x 4 pixels use SSE4.1 instead
+template bool renderRowAVX2<8>(BlockRow<32, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowAVX2<16>(BlockRow<32, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+
+//blocks 64 pixels wide are rendered 4 scanlines at a time, so every height is
+template bool renderRowAVX2<4>(BlockRow<64, 4>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowAVX2<8>(BlockRow<64, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowAVX2<16>(BlockRow<64, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
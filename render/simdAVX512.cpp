@@ -0,0 +1,237 @@
+//GCC 12's AVX-512 intrinsics start some results from an undefined register, which -Wall reports as uninitialized
+//(included before simd.h, as the standard headers it brings in can include immintrin.h too)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+#include "simd.h"
+
+//rasterize triangle into a row of blocks using AVX-512 -- see header for details
+template<int HEIGHT>
+bool renderRowAVX512(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	static_assert(HEIGHT == 8, "AVX-512 kernels put two blocks of 8 scanlines in one register");
+
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i width = _mm512_set1_epi32(32);
+	const __m512i ones = _mm512_set1_epi32(~0);
+
+	//edge flip masks
+	const __m512i flip1 = _mm512_set1_epi32(o1);
+	const __m512i flip2 = _mm512_set1_epi32(o2);
+	const __m512i flip3 = _mm512_set1_epi32(o3);
+
+	//the same 8 scanlines are used for both blocks -- lanes 0-7 are the left block, lanes 8-15 the right one
+	__m512i events1 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*) e1x));
+	__m512i events2 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*) e2x));
+	__m512i events3 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*) e3x));
+
+	bool updated = false; //was any reference depth updated?
+	int j = jStart;
+	for (; j + 1 <= jEnd; j += 2) { //two blocks at a time
+		uint32_t* mask = row.bits + j * HEIGHT; //masks of both blocks, one after the other
+		GLfloat& reference0 = row.reference[j];
+		GLfloat& reference1 = row.reference[j + 1];
+		GLfloat& working0 = row.working[j];
+		GLfloat& working1 = row.working[j + 1];
+
+		//depths of triangle within the blocks
+		GLfloat blockMaxZ0 = maxZ < maxZStart ? maxZ : maxZStart;
+		maxZStart += maxZStep;
+		GLfloat blockMaxZ1 = maxZ < maxZStart ? maxZ : maxZStart;
+		maxZStart += maxZStep;
+
+		//blocks where the triangle is behind everything are left as they are
+		bool skip0 = minZ > reference0;
+		bool skip1 = minZ > reference1;
+		if (skip0 && skip1) {
+			continue;
+		}
+		__mmask16 active = (skip0 ? 0 : 0x00FF) | (skip1 ? 0 : 0xFF00);
+
+		//x coordinates of the blocks in pixel space
+		__m512i blockX = _mm512_mask_blend_epi32(0xFF00, _mm512_set1_epi32(j * 32), _mm512_set1_epi32((j + 1) * 32));
+
+		//heuristic to throw away working layer (same as the scalar version) -- done by clearing the masks below
+		bool discard0 = !skip0 && working0 - blockMaxZ0 > reference0 - working0;
+		bool discard1 = !skip1 && working1 - blockMaxZ1 > reference1 - working1;
+		__mmask16 keep = (discard0 ? 0 : 0x00FF) | (discard1 ? 0 : 0xFF00);
+		if (discard0) {
+			working0 = 0.0f;
+		}
+		if (discard1) {
+			working1 = 0.0f;
+		}
+
+		//merge triangle into working layers
+		if (!skip0) {
+			working0 = working0 < blockMaxZ0 ? blockMaxZ0 : working0;
+		}
+		if (!skip1) {
+			working1 = working1 < blockMaxZ1 ? blockMaxZ1 : working1;
+		}
+
+		//x coordinates of events relative to each block, clamped to [0, 32]
+		__m512i e1 = _mm512_min_epi32(_mm512_max_epi32(_mm512_sub_epi32(events1, blockX), zero), width);
+		__m512i e2 = _mm512_min_epi32(_mm512_max_epi32(_mm512_sub_epi32(events2, blockX), zero), width);
+		__m512i e3 = _mm512_min_epi32(_mm512_max_epi32(_mm512_sub_epi32(events3, blockX), zero), width);
+
+		//masks of 16 scanlines at once
+		__m512i m1 = _mm512_xor_si512(_mm512_srlv_epi32(ones, e1), flip1);
+		__m512i m2 = _mm512_xor_si512(_mm512_srlv_epi32(ones, e2), flip2);
+		__m512i m3 = _mm512_xor_si512(_mm512_srlv_epi32(ones, e3), flip3);
+		__m512i result = _mm512_and_si512(m1, _mm512_and_si512(m2, m3));
+
+		//the masks of neighbouring blocks are next to each other, so both are loaded at once
+		__m512i bits = _mm512_loadu_si512(mask);
+		__m512i merged = _mm512_or_si512(_mm512_maskz_mov_epi32(keep, bits), result);
+		merged = _mm512_mask_mov_epi32(bits, active, merged); //skipped blocks keep their masks
+
+		//update reference layers of full masks
+		__mmask16 full = _mm512_cmpeq_epi32_mask(merged, ones);
+		bool full0 = !skip0 && (full & 0x00FF) == 0x00FF;
+		bool full1 = !skip1 && (full & 0xFF00) == 0xFF00;
+		if (full0) {
+			reference0 = working0 < reference0 ? working0 : reference0;
+			working0 = 0.0f;
+			updated = true;
+		}
+		if (full1) {
+			reference1 = working1 < reference1 ? working1 : reference1;
+			working1 = 0.0f;
+			updated = true;
+		}
+		__mmask16 notFull = (full0 ? 0 : 0x00FF) | (full1 ? 0 : 0xFF00);
+		merged = _mm512_maskz_mov_epi32(notFull, merged);
+
+		_mm512_storeu_si512(mask, merged);
+	}
+
+	if (j <= jEnd) { //leftover block
+		updated = renderRowAVX2(row, j, j, e1x, e2x, e3x, o1, o2, o3, minZ, maxZ, maxZStart, maxZStep) || updated;
+	}
+	return updated;
+}
+
+//rasterize triangle into a row of blocks 64 pixels wide using AVX-512, 8 scanlines at a time -- see header for details
+template<int HEIGHT>
+bool renderRowAVX512(BlockRow<64, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	static_assert(HEIGHT % 8 == 0, "AVX-512 kernels work on 8 scanlines of 64 pixels at a time");
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i width = _mm256_set1_epi32(64);
+	const __m512i ones = _mm512_set1_epi64(~0LL);
+
+	//edge flip masks, widened to 64 bits
+	const __m512i flip1 = _mm512_set1_epi64((int64_t)(int32_t)o1);
+	const __m512i flip2 = _mm512_set1_epi64((int64_t)(int32_t)o2);
+	const __m512i flip3 = _mm512_set1_epi64((int64_t)(int32_t)o3);
+
+	bool updated = false; //was any reference depth updated?
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		uint64_t* mask = row.bits + j * HEIGHT; //masks of this block
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = maxZ < maxZStart ? maxZ : maxZStart; //depth of triangle within this block
+		maxZStart += maxZStep;
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block
+		}
+		__m256i blockX = _mm256_set1_epi32(j * 64); //x coordinate of block in pixel space
+
+		//heuristic to throw away working layer (same as the scalar version) -- done by clearing the masks below
+		bool discard = working - blockMaxZ > reference - working;
+		__mmask8 keep = discard ? 0 : 0xFF;
+		if (discard) {
+			working = 0.0f;
+		}
+
+		//merge triangle into working layer
+		working = working < blockMaxZ ? blockMaxZ : working;
+
+		__mmask8 full = 0xFF; //bits stay set while their scanlines are full
+		for (int k = 0; k < HEIGHT; k += 8) {
+			//x coordinates of events relative to this block, clamped to [0, 64] and widened to 64 bits
+			__m512i e1 = _mm512_cvtepu32_epi64(_mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e1x + k)), blockX), zero), width));
+			__m512i e2 = _mm512_cvtepu32_epi64(_mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e2x + k)), blockX), zero), width));
+			__m512i e3 = _mm512_cvtepu32_epi64(_mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (e3x + k)), blockX), zero), width));
+
+			//masks of 8 scanlines at once
+			__m512i m1 = _mm512_xor_si512(_mm512_srlv_epi64(ones, e1), flip1);
+			__m512i m2 = _mm512_xor_si512(_mm512_srlv_epi64(ones, e2), flip2);
+			__m512i m3 = _mm512_xor_si512(_mm512_srlv_epi64(ones, e3), flip3);
+			__m512i result = _mm512_and_si512(m1, _mm512_and_si512(m2, m3));
+
+			__m512i merged = _mm512_or_si512(_mm512_maskz_mov_epi64(keep, _mm512_loadu_si512(mask + k)), result);
+			_mm512_storeu_si512(mask + k, merged);
+
+			full &= _mm512_cmpeq_epi64_mask(merged, ones);
+		}
+
+		//update reference layer if mask is full
+		if (full == 0xFF) {
+			reference = working < reference ? working : reference;
+			working = 0.0f;
+			updated = true;
+			for (int k = 0; k < HEIGHT; k += 8) {
+				_mm512_storeu_si512(mask + k, _mm512_setzero_si512());
+			}
+		}
+	}
+	return updated;
+}
+
+//true if any block of the row has reference >= minZ, using AVX-512 -- see header for details
+bool testRowAVX512(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ) {
+	const __m512 z = _mm512_set1_ps(minZ);
+
+	int j = jStart;
+	for (; j + 15 <= jEnd; j += 16) {
+		if (_mm512_cmp_ps_mask(_mm512_loadu_ps(reference + j), z, _CMP_GE_OQ) != 0) {
+			return true;
+		}
+	}
+
+	if (j <= jEnd) { //leftover blocks
+		return testRowAVX2(reference, j, jEnd, minZ);
+	}
+	return false;
+}
+
+//test boxes against the frustum planes using AVX-512, 16 boxes at a time -- see header for details
+void frustumTestAVX512(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside) {
+	int i = start;
+	for (; i + 15 < end; i += 16) {
+		__mmask16 outside = 0; //bits are set once their box is outside a plane
+		for (int k = 0; k < 6; k++) {
+			const glm::vec4& p = planes[k];
+
+			//corners of the boxes farthest along the plane normal -- if one is outside, its whole box is
+			__m512 px = _mm512_loadu_ps(p.x > 0.0f ? &boxes.maxX[i] : &boxes.minX[i]);
+			__m512 py = _mm512_loadu_ps(p.y > 0.0f ? &boxes.maxY[i] : &boxes.minY[i]);
+			__m512 pz = _mm512_loadu_ps(p.z > 0.0f ? &boxes.maxZ[i] : &boxes.minZ[i]);
+
+			//distances to the plane, added up in the same order as the scalar version
+			__m512 d = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(p.x), px), _mm512_mul_ps(_mm512_set1_ps(p.y), py));
+			d = _mm512_add_ps(_mm512_add_ps(d, _mm512_mul_ps(_mm512_set1_ps(p.z), pz)), _mm512_set1_ps(p.w));
+			outside |= _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_LT_OQ);
+		}
+
+		for (int b = 0; b < 16; b++) {
+			inside[i + b] = (outside >> b) & 1 ? 0 : 1;
+		}
+	}
+
+	frustumTestAVX2(boxes, i, end, planes, inside); //leftover boxes
+}
+
+//kernels for the supported block sizes -- rendering puts two blocks of 8 scanlines in one register, so only blocks 32 x 8 pixels are rendered here
+template bool renderRowAVX512<8>(BlockRow<32, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+
+//blocks 64 pixels wide are rendered 8 scanlines at a time -- blocks 64 x 4 pixels would only fill half a register, so AVX2 renders them
+template bool renderRowAVX512<8>(BlockRow<64, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowAVX512<16>(BlockRow<64, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
@@ -0,0 +1,190 @@
+#include "simd.h"
+#include <smmintrin.h>
+
+/*	~0 >> e for each lane, with e in [0, 32]
+
+	SSE has no shift with a different count per lane, so the bit 31 - e is made by
+	writing 31 - e into the exponent of a float and converting it back to an integer,
+	then all bits below it are set
+
+	for e = 0, 2^31 doesn't fit in an int32 and the conversion gives 0x80000000, which happens to be the right bit
+*/
+static inline __m128i shiftedOnes(__m128i e) {
+	__m128i exponent = _mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 31), e), 23);
+	__m128i bit = _mm_cvttps_epi32(_mm_castsi128_ps(exponent));
+	__m128i mask = _mm_or_si128(bit, _mm_sub_epi32(bit, _mm_set1_epi32(1)));
+	return _mm_andnot_si128(_mm_cmpgt_epi32(e, _mm_set1_epi32(31)), mask); //shifting by 32 gives 0, like in line()
+}
+
+//rasterize triangle into a row of blocks using SSE4.1 -- see header for details
+template<int HEIGHT>
+bool renderRowSSE41(BlockRow<32, HEIGHT> row, int jStart, int jEnd, const int32_t* e1x, const int32_t* e2x, const int32_t* e3x, uint32_t o1, uint32_t o2, uint32_t o3, GLfloat minZ, GLfloat maxZ, GLfloat maxZStart, GLfloat maxZStep) {
+	static_assert(HEIGHT % 4 == 0, "SSE4.1 kernels work on 4 scanlines at a time");
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i width = _mm_set1_epi32(32);
+	const __m128i ones = _mm_set1_epi32(~0);
+
+	//edge flip masks
+	const __m128i flip1 = _mm_set1_epi32(o1);
+	const __m128i flip2 = _mm_set1_epi32(o2);
+	const __m128i flip3 = _mm_set1_epi32(o3);
+
+	bool updated = false; //was any reference depth updated?
+	for (int j = jStart; j <= jEnd; j++) { //iterate over width
+		uint32_t* mask = row.bits + j * HEIGHT; //masks of this block
+		GLfloat& reference = row.reference[j];
+		GLfloat& working = row.working[j];
+		GLfloat blockMaxZ = maxZ < maxZStart ? maxZ : maxZStart; //depth of triangle within this block
+		maxZStart += maxZStep;
+		if (minZ > reference) {
+			continue; //triangle is behind everything in this block
+		}
+		__m128i blockX = _mm_set1_epi32(j * 32); //x coordinate of block in pixel space
+
+		//heuristic to throw away working layer (same as the scalar version) -- done by clearing the masks below
+		GLfloat dist1t = working - blockMaxZ;
+		GLfloat dist01 = reference - working;
+		bool discard = dist1t > dist01;
+		__m128i keep = discard ? _mm_setzero_si128() : ones;
+		if (discard) {
+			working = 0.0f;
+		}
+
+		//merge triangle into working layer
+		working = working < blockMaxZ ? blockMaxZ : working;
+
+		__m128i full = ones; //lanes stay all 1s while their scanlines are full
+		for (int k = 0; k < HEIGHT; k += 4) {
+			//x coordinates of events relative to this block, clamped to [0, 32]
+			__m128i e1 = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e1x + k)), blockX), zero), width);
+			__m128i e2 = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e2x + k)), blockX), zero), width);
+			__m128i e3 = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i*) (e3x + k)), blockX), zero), width);
+
+			//masks of 4 scanlines at once
+			__m128i m1 = _mm_xor_si128(shiftedOnes(e1), flip1);
+			__m128i m2 = _mm_xor_si128(shiftedOnes(e2), flip2);
+			__m128i m3 = _mm_xor_si128(shiftedOnes(e3), flip3);
+			__m128i result = _mm_and_si128(m1, _mm_and_si128(m2, m3));
+
+			__m128i* bits = (__m128i*) (mask + k);
+			__m128i merged = _mm_or_si128(_mm_and_si128(_mm_loadu_si128(bits), keep), result);
+			_mm_storeu_si128(bits, merged);
+
+			full = _mm_and_si128(full, merged);
+		}
+
+		//update reference layer if mask is full
+		if (_mm_test_all_ones(full)) {
+			reference = working < reference ? working : reference;
+			working = 0.0f;
+			updated = true;
+			for (int k = 0; k < HEIGHT; k += 4) {
+				_mm_storeu_si128((__m128i*) (mask + k), _mm_setzero_si128());
+			}
+		}
+	}
+	return updated;
+}
+
+//true if any block of the row has reference >= minZ, using SSE4.1 -- see header for details
+bool testRowSSE41(const GLfloat* reference, int jStart, int jEnd, GLfloat minZ) {
+	const __m128 z = _mm_set1_ps(minZ);
+
+	int j = jStart;
+	for (; j + 3 <= jEnd; j += 4) {
+		if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(reference + j), z)) != 0) {
+			return true;
+		}
+	}
+
+	for (; j <= jEnd; j++) { //leftover blocks
+		if (reference[j] >= minZ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//one row of a matrix times 4 points -- added up like glm does, so the results are exactly the same as the scalar version
+static inline __m128 transformRow(const GLfloat* m, int r, __m128 x, __m128 y, __m128 z) {
+	__m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[r]), x), _mm_mul_ps(_mm_set1_ps(m[4 + r]), y));
+	__m128 zw = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[8 + r]), z), _mm_set1_ps(m[12 + r]));
+	return _mm_add_ps(xy, zw);
+}
+
+//min and max of the 4 lanes, broadcast to all lanes
+static inline __m128 horizontalMin(__m128 v) {
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+static inline __m128 horizontalMax(__m128 v) {
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+//project corners of a bounding box using SSE4.1, 4 corners at a time -- see header for details
+bool projectBoxSSE41(const WorldBounds& b, const glm::mat4& m, GLfloat& minX, GLfloat& maxX, GLfloat& minY, GLfloat& maxY, GLfloat& minZ, GLfloat& maxZ) {
+	const GLfloat* mat = reinterpret_cast<const GLfloat*>(&m); //column major -- not &m[0][0], see simd.h
+	__m128 nx[2], ny[2], nz[2];
+	for (int h = 0; h < 2; h++) {
+		__m128 x = _mm_loadu_ps(b.cornerX + 4 * h);
+		__m128 y = _mm_loadu_ps(b.cornerY + 4 * h);
+		__m128 z = _mm_loadu_ps(b.cornerZ + 4 * h);
+
+		__m128 cx = transformRow(mat, 0, x, y, z);
+		__m128 cy = transformRow(mat, 1, x, y, z);
+		__m128 cz = transformRow(mat, 2, x, y, z);
+		__m128 cw = transformRow(mat, 3, x, y, z);
+
+		//corner behind the near plane (z < -w)
+		if (_mm_movemask_ps(_mm_cmplt_ps(cz, _mm_sub_ps(_mm_setzero_ps(), cw))) != 0) {
+			return false;
+		}
+
+		nx[h] = _mm_div_ps(cx, cw);
+		ny[h] = _mm_div_ps(cy, cw);
+		nz[h] = _mm_div_ps(cz, cw);
+	}
+
+	minX = _mm_cvtss_f32(horizontalMin(_mm_min_ps(nx[0], nx[1])));
+	maxX = _mm_cvtss_f32(horizontalMax(_mm_max_ps(nx[0], nx[1])));
+	minY = _mm_cvtss_f32(horizontalMin(_mm_min_ps(ny[0], ny[1])));
+	maxY = _mm_cvtss_f32(horizontalMax(_mm_max_ps(ny[0], ny[1])));
+	minZ = _mm_cvtss_f32(horizontalMin(_mm_min_ps(nz[0], nz[1])));
+	maxZ = _mm_cvtss_f32(horizontalMax(_mm_max_ps(nz[0], nz[1])));
+	return true;
+}
+
+//test boxes against the frustum planes using SSE4.1, 4 boxes at a time -- see header for details
+void frustumTestSSE41(const BoxArrays& boxes, int start, int end, const glm::vec4* planes, uint8_t* inside) {
+	int i = start;
+	for (; i + 3 < end; i += 4) {
+		__m128 outside = _mm_setzero_ps(); //lanes become all 1s once their box is outside a plane
+		for (int k = 0; k < 6; k++) {
+			const glm::vec4& p = planes[k];
+
+			//corners of the boxes farthest along the plane normal -- if one is outside, its whole box is
+			__m128 px = _mm_loadu_ps(p.x > 0.0f ? &boxes.maxX[i] : &boxes.minX[i]);
+			__m128 py = _mm_loadu_ps(p.y > 0.0f ? &boxes.maxY[i] : &boxes.minY[i]);
+			__m128 pz = _mm_loadu_ps(p.z > 0.0f ? &boxes.maxZ[i] : &boxes.minZ[i]);
+
+			//distances to the plane, added up in the same order as the scalar version
+			__m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), px), _mm_mul_ps(_mm_set1_ps(p.y), py));
+			d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.z), pz)), _mm_set1_ps(p.w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int b = 0; b < 4; b++) {
+			inside[i + b] = (mask >> b) & 1 ? 0 : 1;
+		}
+	}
+
+	frustumTestScalar(boxes, i, end, planes, inside); //leftover boxes
+}
+
+//kernels for every supported block height
+template bool renderRowSSE41<4>(BlockRow<32, 4>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowSSE41<8>(BlockRow<32, 8>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
+template bool renderRowSSE41<16>(BlockRow<32, 16>, int, int, const int32_t*, const int32_t*, const int32_t*, uint32_t, uint32_t, uint32_t, GLfloat, GLfloat, GLfloat, GLfloat);
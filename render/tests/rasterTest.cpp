@@ -0,0 +1,415 @@
+/*	raster test -- checks which pixels the rasterizer covers (see setupTriangle in cull.h) against a per-pixel reference,
+	for every block size
+
+	the reference snaps the points to fixed point like setupTriangle does, and then tests the center of every pixel of
+	the depth buffer against the three edges, with the top-left rule written out directly -- the rasterizer instead
+	walks its edges down the scanlines and makes masks, so the two only agree if the walk is exact
+
+	points are often put on pixel centers and pixel corners, so centers land right on edges and points, and they go out
+	to the guard band (see GUARD_BAND), where the edges start far outside of the buffer
+
+	the blocks of each row are classified too (see RowCoverage in raster.h) -- blocks outside of the ones the triangle
+	might touch must have no pixel covered, and the blocks it covers entirely must be exactly the ones with every
+	pixel covered
+
+	the depths given to the blocks of each row (see RowDepths in raster.h) must never be nearer than the triangle is
+	anywhere within the block -- that's worked out from the triangle clipped to the block, in long double, and then
+	compared to the depths as the kernels add them up in floats
+
+	polygons are split into triangles two different ways too -- the triangles of a split must never cover the same
+	pixel, and both splits must cover the same pixels, so no pixel along a shared edge is covered twice or left out
+
+	run with ctest, or on its own -- returns 0 if every check passes
+*/
+
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "../cull.h"
+#include "../raster.h"
+#include "../utility.h"
+
+static const int BUFFER_WIDTH = 200; //size of the depth buffer the triangles are rasterized into
+static const int BUFFER_HEIGHT = 120;
+static const int TRIANGLES = 1500; //triangles tried for each block size
+static const int POLYGONS = 300; //polygons tried for each block size
+static const int PLANES = 3000; //triangles whose depths are checked for each block size
+
+static std::mt19937 rng(12345);
+
+static GLfloat randomFloat(GLfloat min, GLfloat max) {
+	return std::uniform_real_distribution<GLfloat>(min, max)(rng);
+}
+
+static int randomInt(int min, int max) {
+	return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+//point in fixed point pixel space, snapped the same way as in setupTriangle
+struct Snapped {
+	int64_t x, y;
+};
+
+static Snapped snap(glm::vec2 p) {
+	convertVec(p);
+	const double one = (double)(1 << SUBPIXEL_BITS);
+	Snapped s = { (int64_t)std::floor(p.x * one + 0.5), (int64_t)std::floor(p.y * one + 0.5) };
+	return s;
+}
+
+//twice the signed area of triangle a, b, c in fixed point -- positive if c is right of a to b (y is down)
+static int64_t cross(const Snapped& a, const Snapped& b, const Snapped& c) {
+	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+/*	true if the center of pixel (x, y) is inside the triangle -- the reference
+
+	a center on an edge belongs to the triangle if the triangle is right of the edge, or below it if the edge is
+	horizontal, so it belongs to exactly one of two triangles sharing the edge
+*/
+static bool referenceCovers(const Snapped* p, int x, int y) {
+	const int64_t half = (1 << SUBPIXEL_BITS) / 2;
+	Snapped c = { ((int64_t)x << SUBPIXEL_BITS) + half, ((int64_t)y << SUBPIXEL_BITS) + half };
+	int64_t area = cross(p[0], p[1], p[2]);
+	if (area == 0) {
+		return false;
+	}
+	int64_t sign = area > 0 ? 1 : -1;
+	for (int k = 0; k < 3; k++) {
+		const Snapped& a = p[k];
+		const Snapped& b = p[(k + 1) % 3];
+		int64_t e = sign * cross(a, b, c); //positive inside
+		if (e < 0) {
+			return false;
+		}
+		if (e == 0) {
+			//direction the edge function grows in, which points into the triangle
+			int64_t nx = -sign * (b.y - a.y);
+			int64_t ny = sign * (b.x - a.x);
+			if (!(nx > 0 || (nx == 0 && ny > 0))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//true if pixel (x, y) is set in the masks of the depth buffer -- blocks not rendered into this frame are empty
+template<int WIDTH>
+static bool maskCovers(int x, int y) {
+	uint32_t k = (y / dBuffer.blockHeight) * dBuffer.widthB + x / WIDTH;
+	if (dBuffer.epochs[k] != dBuffer.epoch) {
+		return false;
+	}
+	BlockMask<WIDTH> mask = ((BlockMask<WIDTH>*) dBuffer.bits)[k * dBuffer.blockHeight + y % dBuffer.blockHeight];
+	return ((mask >> (WIDTH - 1 - x % WIDTH)) & 1) != 0;
+}
+
+//rasterize a triangle into an empty depth buffer, and set covered[pixel] for every pixel it covers
+static void rasterizeAlone(glm::vec2 a, glm::vec2 b, glm::vec2 c, std::vector<uint8_t>& covered) {
+	dBuffer.reset();
+	rasterize(a, b, c);
+	covered.resize(dBuffer.width * dBuffer.height);
+	for (int y = 0; y < (int)dBuffer.height; y++) {
+		for (int x = 0; x < (int)dBuffer.width; x++) {
+			covered[y * dBuffer.width + x] = dBuffer.blockWidth == 64 ? maskCovers<64>(x, y) : maskCovers<32>(x, y);
+		}
+	}
+}
+
+/*	random point in NDC space
+
+	a third are on pixel centers and a third on pixel corners (nearly -- snapping puts them right on them), and some
+	are out at the guard band, where edges start far from the buffer
+*/
+static glm::vec2 randomPoint(GLfloat range) {
+	glm::vec2 p(randomFloat(-range, range), randomFloat(-range, range));
+	int kind = randomInt(0, 2);
+	if (kind != 0) {
+		//pixel space -> NDC space, the other way around from convertVec
+		GLfloat w = (GLfloat)(dBuffer.width - 1) / 2.0f;
+		GLfloat h = (GLfloat)(dBuffer.height - 1) / 2.0f;
+		GLfloat offset = kind == 1 ? 0.5f : 0.0f;
+		p.x = (std::floor(p.x * w + w) + offset - w) / w;
+		p.y = -(std::floor(-p.y * h + h) + offset - h) / h;
+	}
+	return p;
+}
+
+//point near p, a few pixels away at most -- for small and thin triangles
+static glm::vec2 nearPoint(glm::vec2 p) {
+	GLfloat pixels = randomFloat(0.0f, 6.0f);
+	return p + glm::vec2(randomFloat(-1.0f, 1.0f) * pixels * 2.0f / dBuffer.width, randomFloat(-1.0f, 1.0f) * pixels * 2.0f / dBuffer.height);
+}
+
+//count the pixels where the rasterizer disagrees with the reference, over random triangles
+static int testTriangles() {
+	std::vector<uint8_t> covered;
+	int mismatches = 0;
+	for (int t = 0; t < TRIANGLES; t++) {
+		//big triangles out to past the guard band, small ones, and thin ones
+		GLfloat range = t % 3 == 0 ? GUARD_BAND + 0.2f : 1.0f;
+		glm::vec2 a = randomPoint(range);
+		glm::vec2 b = t % 3 == 1 ? nearPoint(a) : randomPoint(range);
+		glm::vec2 c = t % 3 == 2 ? nearPoint(randomInt(0, 1) ? a : b) : (t % 3 == 1 ? nearPoint(a) : randomPoint(range));
+
+		rasterizeAlone(a, b, c, covered);
+		Snapped p[3] = { snap(a), snap(b), snap(c) };
+		for (int y = 0; y < (int)dBuffer.height; y++) {
+			for (int x = 0; x < (int)dBuffer.width; x++) {
+				mismatches += covered[y * dBuffer.width + x] != referenceCovers(p, x, y);
+			}
+		}
+	}
+	return mismatches;
+}
+
+/*	count the blocks a triangle's RowCoverage gets wrong, for blocks of WIDTH x HEIGHT pixels
+
+	a block left out of first..last must have no pixel covered, and fullStart..fullEnd must be exactly the blocks
+	with every pixel covered
+*/
+template<int WIDTH, int HEIGHT>
+static int classifyRows(glm::vec2 a, glm::vec2 b, glm::vec2 c) {
+	TriangleSetup t;
+	setupTriangle(glm::vec3(a, 0.0f), glm::vec3(b, 0.0f), glm::vec3(c, 0.0f), t);
+	Snapped p[3] = { snap(a), snap(b), snap(c) };
+
+	int32_t e1x[HEIGHT], e2x[HEIGHT], e3x[HEIGHT];
+	TriangleWalk walk;
+	walk.start(t, t.iStart * HEIGHT);
+	int mismatches = 0;
+	for (int i = t.iStart; i <= t.iEnd; i++) {
+		walk.events(t, HEIGHT, e1x, e2x, e3x);
+		RowCoverage coverage;
+		coverage.classify<WIDTH, HEIGHT>(t, i * HEIGHT, e1x, e2x, e3x);
+
+		for (int j = 0; j < (int)dBuffer.widthB; j++) {
+			int covered = 0;
+			for (int y = i * HEIGHT; y < (i + 1) * HEIGHT; y++) {
+				for (int x = j * WIDTH; x < (j + 1) * WIDTH; x++) {
+					covered += referenceCovers(p, x, y);
+				}
+			}
+			bool touched = j >= coverage.first && j <= coverage.last;
+			bool full = j >= coverage.fullStart && j <= coverage.fullEnd;
+			mismatches += (covered > 0 && !touched) || (full != (covered == WIDTH * HEIGHT));
+		}
+	}
+	return mismatches;
+}
+
+//count the blocks RowCoverage gets wrong over random triangles, for the block size of the depth buffer
+static int testClassify() {
+	int mismatches = 0;
+	for (int t = 0; t < TRIANGLES; t++) {
+		//big triangles, which cover whole blocks, and small and thin ones
+		GLfloat range = t % 3 == 0 ? GUARD_BAND + 0.2f : 1.0f;
+		glm::vec2 a = randomPoint(range);
+		glm::vec2 b = t % 3 == 2 ? nearPoint(a) : randomPoint(range);
+		glm::vec2 c = randomPoint(range);
+
+		switch (dBuffer.blockHeight * 100 + dBuffer.blockWidth) {
+		case 432: mismatches += classifyRows<32, 4>(a, b, c); break;
+		case 832: mismatches += classifyRows<32, 8>(a, b, c); break;
+		case 1632: mismatches += classifyRows<32, 16>(a, b, c); break;
+		case 464: mismatches += classifyRows<64, 4>(a, b, c); break;
+		case 864: mismatches += classifyRows<64, 8>(a, b, c); break;
+		default: mismatches += classifyRows<64, 16>(a, b, c);
+		}
+	}
+	return mismatches;
+}
+
+//point in pixel space with a depth, for clipping triangles to blocks
+struct Point {
+	long double x, y, z;
+};
+
+//keep the part of polygon on the side of the line where k * x + l * y <= m -- the depth is interpolated along the way
+static void clip(std::vector<Point>& polygon, long double k, long double l, long double m) {
+	std::vector<Point> kept;
+	for (size_t i = 0; i < polygon.size(); i++) {
+		const Point& a = polygon[i];
+		const Point& b = polygon[(i + 1) % polygon.size()];
+		long double da = k * a.x + l * a.y - m;
+		long double db = k * b.x + l * b.y - m;
+		if (da <= 0) {
+			kept.push_back(a);
+		}
+		if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+			long double f = da / (da - db);
+			Point p = { a.x + f * (b.x - a.x), a.y + f * (b.y - a.y), a.z + f * (b.z - a.z) };
+			kept.push_back(p);
+		}
+	}
+	polygon.swap(kept);
+}
+
+/*	count the blocks whose depth from RowDepths is nearer than the triangle within them, for blocks of WIDTH x HEIGHT pixels
+
+	the triangle is clipped to each block, cut down to the scanlines it covers like RowDepths does -- the deepest
+	point left is at a corner of what's left, and the depth given to the block has to be at least as deep
+	the depths are added up over the whole range of blocks the triangle might touch, and over a random part of it,
+	as the rasterizer gives the kernels runs of blocks starting anywhere
+*/
+template<int WIDTH, int HEIGHT>
+static int depthPlanes(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+	TriangleSetup t;
+	setupTriangle(a, b, c, t);
+
+	//points in pixel space, as setupTriangle has them before snapping
+	glm::vec2 pa(a), pb(b), pc(c);
+	convertVec(pa);
+	convertVec(pb);
+	convertVec(pc);
+	Point points[3] = { { pa.x, pa.y, a.z }, { pb.x, pb.y, b.z }, { pc.x, pc.y, c.z } };
+
+	int mismatches = 0;
+	for (int i = t.iStart; i <= t.iEnd; i++) {
+		RowDepths<WIDTH, HEIGHT> depths;
+		depths.start(t, i);
+		int yTop = std::max(i * HEIGHT, t.yStart);
+		int yBottom = std::min((i + 1) * HEIGHT, t.yEnd + 1);
+
+		for (int run = 0; run < 2; run++) {
+			int jStart = run == 0 ? t.jStart : randomInt(t.jStart, t.jEnd);
+			int jEnd = run == 0 ? t.jEnd : randomInt(jStart, t.jEnd);
+			GLfloat maxZStart, maxZStep;
+			depths.run(jStart, jEnd, maxZStart, maxZStep);
+
+			for (int j = jStart; j <= jEnd; j++) {
+				GLfloat blockMaxZ = std::min(maxZStart, t.maxZ); //as in the kernels
+				maxZStart += maxZStep;
+
+				std::vector<Point> polygon(points, points + 3);
+				clip(polygon, -1, 0, -(long double)j * WIDTH);
+				clip(polygon, 1, 0, (long double)(j + 1) * WIDTH);
+				clip(polygon, 0, -1, -(long double)yTop);
+				clip(polygon, 0, 1, (long double)yBottom);
+				for (const Point& p : polygon) {
+					mismatches += p.z > blockMaxZ;
+					if (p.z > blockMaxZ) {
+						break;
+					}
+				}
+			}
+		}
+	}
+	return mismatches;
+}
+
+//depth for depthPlanes -- anywhere in NDC space, or near the far plane where depths are close together
+static GLfloat randomZ(bool far) {
+	return far ? randomFloat(0.999f, 1.0f) : randomFloat(-1.0f, 1.0f);
+}
+
+//count the blocks RowDepths gives too near a depth over random triangles, for the block size of the depth buffer
+static int testDepths() {
+	int mismatches = 0;
+	for (int t = 0; t < PLANES; t++) {
+		//big triangles, whose depths are added up over many blocks, and small and thin ones, whose planes are steep
+		GLfloat range = t % 3 == 0 ? GUARD_BAND + 0.2f : 1.0f;
+		glm::vec2 a = randomPoint(range);
+		glm::vec2 b = t % 3 == 2 ? nearPoint(a) : randomPoint(range);
+		glm::vec2 c = randomPoint(range);
+		bool far = randomInt(0, 1) == 0;
+		glm::vec3 pa(a, randomZ(far)), pb(b, randomZ(far)), pc(c, randomZ(far));
+		if (randomInt(0, 7) == 0) {
+			pb.z = pa.z; //a level edge
+		}
+
+		switch (dBuffer.blockHeight * 100 + dBuffer.blockWidth) {
+		case 432: mismatches += depthPlanes<32, 4>(pa, pb, pc); break;
+		case 832: mismatches += depthPlanes<32, 8>(pa, pb, pc); break;
+		case 1632: mismatches += depthPlanes<32, 16>(pa, pb, pc); break;
+		case 464: mismatches += depthPlanes<64, 4>(pa, pb, pc); break;
+		case 864: mismatches += depthPlanes<64, 8>(pa, pb, pc); break;
+		default: mismatches += depthPlanes<64, 16>(pa, pb, pc);
+		}
+	}
+	return mismatches;
+}
+
+/*	count the pixels covered twice by the triangles of a split, or by one split but not the other, over random polygons
+
+	each polygon is convex, with points around an ellipse -- one split fans out from a point inside, the other from
+	the polygon's first point
+*/
+static int testSplits() {
+	std::vector<uint8_t> covered;
+	std::vector<uint8_t> countA, countB;
+	int mismatches = 0;
+	for (int t = 0; t < POLYGONS; t++) {
+		int n = randomInt(3, 8);
+		glm::vec2 center(randomFloat(-1.5f, 1.5f), randomFloat(-1.5f, 1.5f));
+		glm::vec2 radius = t % 2 == 0 ? glm::vec2(randomFloat(0.3f, 2.0f), randomFloat(0.3f, 2.0f))
+			: glm::vec2(randomFloat(0.01f, 0.1f), randomFloat(0.01f, 0.1f));
+		std::vector<glm::vec2> points(n);
+		GLfloat turn = randomFloat(0.0f, 6.2831853f);
+		for (int k = 0; k < n; k++) {
+			GLfloat angle = turn + 6.2831853f * (k + randomFloat(-0.3f, 0.3f)) / n;
+			points[k] = center + radius * glm::vec2(std::cos(angle), std::sin(angle));
+		}
+
+		//snapping can make a polygon with nearly straight corners concave, and the points can leave the center
+		//outside of it -- those are tried again
+		bool convex = true;
+		int64_t sign = cross(snap(points[0]), snap(points[1]), snap(center));
+		for (int k = 0; k < n; k++) {
+			int64_t c = cross(snap(points[k]), snap(points[(k + 1) % n]), snap(points[(k + 2) % n]));
+			int64_t inside = cross(snap(points[k]), snap(points[(k + 1) % n]), snap(center));
+			convex = convex && c != 0 && inside != 0 && (c > 0) == (sign > 0) && (inside > 0) == (sign > 0);
+		}
+		if (!convex) {
+			t--;
+			continue;
+		}
+
+		countA.assign(dBuffer.width * dBuffer.height, 0);
+		countB.assign(dBuffer.width * dBuffer.height, 0);
+		for (int k = 0; k < n; k++) {
+			rasterizeAlone(center, points[k], points[(k + 1) % n], covered);
+			for (size_t i = 0; i < covered.size(); i++) {
+				countA[i] += covered[i];
+			}
+		}
+		for (int k = 1; k + 1 < n; k++) {
+			rasterizeAlone(points[0], points[k], points[k + 1], covered);
+			for (size_t i = 0; i < covered.size(); i++) {
+				countB[i] += covered[i];
+			}
+		}
+		for (size_t i = 0; i < countA.size(); i++) {
+			mismatches += countA[i] > 1 || countB[i] > 1 || countA[i] != countB[i];
+		}
+	}
+	return mismatches;
+}
+
+static bool check(const std::string& name, int mismatches, const char* what) {
+	std::cout << name << ": " << (mismatches == 0 ? "ok" : "FAILED") << " (" << mismatches << " " << what << " differ)" << std::endl;
+	return mismatches == 0;
+}
+
+int main() {
+	bool ok = true;
+	const int widths[] = { 32, 64 };
+	const int heights[] = { 4, 8, 16 };
+	for (int w : widths) {
+		for (int h : heights) {
+			dBuffer.resize(BUFFER_WIDTH, BUFFER_HEIGHT, w, h);
+			std::string size = std::to_string(w) + "x" + std::to_string(h);
+			ok &= check("triangles " + size, testTriangles(), "pixels");
+			ok &= check("block classification " + size, testClassify(), "blocks");
+			ok &= check("depth planes " + size, testDepths(), "blocks");
+			ok &= check("shared edges " + size, testSplits(), "pixels");
+		}
+	}
+	return ok ? 0 : 1;
+}
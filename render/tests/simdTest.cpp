@@ -0,0 +1,292 @@
+/*	simd test -- checks that the kernels of every instruction set this CPU supports give exactly the same results as
+	the scalar versions (see simd.h)
+
+	the boxes are made to lie right on a frustum plane, where the last bit of rounding decides which side they're
+	on -- so a kernel whose multiplies and adds were fused by the compiler (see CMakeLists.txt) fails this
+
+	the render kernels get random rows of blocks and random events, for every block size -- their masks, reference
+	and working depths must come out byte for byte the same as the scalar kernel's
+
+	run with ctest, or on its own -- returns 0 if every kernel matches
+*/
+
+#include <iostream>
+#include <random>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../simd.h"
+
+static const int BOX_COUNT = 4099; //not a multiple of any vector width, so the leftover boxes are tested too
+static const int TRIES = 64; //sets of planes and matrices tried
+
+static const int ROW_BLOCKS = 37; //blocks in a row given to the render and test kernels -- odd, so kernels doing several at once have leftovers
+static const int ROW_TRIES = 20000; //triangles given to each render kernel, and ranges to each test kernel
+
+static std::mt19937 rng(12345);
+
+static GLfloat randomFloat(GLfloat min, GLfloat max) {
+	return std::uniform_real_distribution<GLfloat>(min, max)(rng);
+}
+
+/*	make boxes that touch plane k of planes with the corner farthest along its normal -- the other planes are
+	far away, so only plane k decides whether a box is inside
+*/
+static void makePlaneBoxes(glm::vec4* planes, int k, WorldBoxes& boxes) {
+	for (int i = 0; i < 6; i++) {
+		glm::vec3 n = glm::normalize(glm::vec3(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f)));
+		planes[i] = glm::vec4(n, i == k ? randomFloat(-10.0f, 10.0f) : 10000.0f);
+	}
+	const glm::vec4& n = planes[k];
+
+	for (int i = 0; i < BOX_COUNT; i++) {
+		//farthest corner, with z solved from the plane equation and moved a few steps of rounding either way
+		GLfloat px = randomFloat(-50.0f, 50.0f);
+		GLfloat py = randomFloat(-50.0f, 50.0f);
+		GLfloat pz = -((n.x * px + n.y * py) + n.w) / n.z;
+		for (int steps = std::uniform_int_distribution<int>(-3, 3)(rng); steps != 0; steps += steps > 0 ? -1 : 1) {
+			pz = std::nextafter(pz, steps > 0 ? 1e30f : -1e30f);
+		}
+
+		GLfloat sizeX = randomFloat(0.1f, 5.0f);
+		GLfloat sizeY = randomFloat(0.1f, 5.0f);
+		GLfloat sizeZ = randomFloat(0.1f, 5.0f);
+		boxes.minX[i] = n.x > 0.0f ? px - sizeX : px;
+		boxes.maxX[i] = n.x > 0.0f ? px : px + sizeX;
+		boxes.minY[i] = n.y > 0.0f ? py - sizeY : py;
+		boxes.maxY[i] = n.y > 0.0f ? py : py + sizeY;
+		boxes.minZ[i] = n.z > 0.0f ? pz - sizeZ : pz;
+		boxes.maxZ[i] = n.z > 0.0f ? pz : pz + sizeZ;
+	}
+}
+
+//count the boxes where kernel disagrees with the scalar frustum test
+static int testFrustum(FrustumTestFunction kernel) {
+	WorldBoxes boxes;
+	for (std::vector<GLfloat>* v : { &boxes.minX, &boxes.minY, &boxes.minZ, &boxes.maxX, &boxes.maxY, &boxes.maxZ }) {
+		v->resize(BOX_COUNT);
+	}
+	BoxArrays arrays = { boxes.minX.data(), boxes.minY.data(), boxes.minZ.data(), boxes.maxX.data(), boxes.maxY.data(), boxes.maxZ.data() };
+	std::vector<uint8_t> expected(BOX_COUNT), inside(BOX_COUNT);
+
+	int mismatches = 0;
+	for (int t = 0; t < TRIES; t++) {
+		glm::vec4 planes[6];
+		makePlaneBoxes(planes, t % 6, boxes);
+
+		//start past 0 too, so kernels that don't begin on a vector boundary are checked
+		int start = t % 3;
+		frustumTestScalar(arrays, start, BOX_COUNT, planes, expected.data());
+		kernel(arrays, start, BOX_COUNT, planes, inside.data());
+		for (int i = start; i < BOX_COUNT; i++) {
+			mismatches += inside[i] != expected[i];
+		}
+	}
+	return mismatches;
+}
+
+//count the boxes where kernel disagrees with the scalar box projection -- every output must be bit for bit the same
+static int testProject(ProjectBoxFunction kernel) {
+	int mismatches = 0;
+	for (int t = 0; t < TRIES; t++) {
+		glm::vec3 eye(randomFloat(-20.0f, 20.0f), randomFloat(-5.0f, 5.0f), randomFloat(-20.0f, 20.0f));
+		glm::vec3 target(randomFloat(-20.0f, 20.0f), randomFloat(-5.0f, 5.0f), randomFloat(-20.0f, 20.0f));
+		glm::mat4 m = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 0.1f, 100.0f) * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		for (int i = 0; i < BOX_COUNT; i++) {
+			WorldBounds b;
+			for (int c = 0; c < 8; c++) {
+				b.cornerX[c] = randomFloat(-50.0f, 50.0f);
+				b.cornerY[c] = randomFloat(-50.0f, 50.0f);
+				b.cornerZ[c] = randomFloat(-50.0f, 50.0f);
+			}
+
+			GLfloat expected[6], bounds[6];
+			bool expectedFront = projectBoxScalar(b, m, expected[0], expected[1], expected[2], expected[3], expected[4], expected[5]);
+			bool front = kernel(b, m, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+			if (front != expectedFront || (front && std::memcmp(bounds, expected, sizeof(bounds)) != 0)) {
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+static int randomInt(int min, int max) {
+	return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+//mask of a scanline for the render kernels -- empty, full, almost full or random, so blocks often end up full
+template<int WIDTH>
+static BlockMask<WIDTH> randomMask() {
+	const BlockMask<WIDTH> full = ~(BlockMask<WIDTH>)0;
+	switch (randomInt(0, 3)) {
+	case 0:
+		return 0;
+	case 1:
+		return full;
+	case 2:
+		return full ^ ((BlockMask<WIDTH>)1 << randomInt(0, WIDTH - 1));
+	default:
+		return ((BlockMask<WIDTH>)rng() << 32 % WIDTH) ^ rng(); //the shift is 0 for 32 bit masks
+	}
+}
+
+//depth for the render kernels -- half of them are multiples of 1/16 (-0 among them), so depths often tie, and the differences the
+//kernels compare come out exact
+static GLfloat randomDepth(GLfloat min, GLfloat max) {
+	if (randomInt(0, 1) == 0) {
+		return randomFloat(min, max);
+	}
+	return std::ceil(min * 16.0f + randomInt(0, (int)((max - min) * 16.0f))) / 16.0f;
+}
+
+/*	event of an edge for the render kernels
+
+	in a covering triangle, left edges stay left of left and right edges right of right, so the blocks in between
+	get full masks -- otherwise events are anywhere in the row or a little outside it, and now and then far outside
+*/
+static int32_t randomEvent(int width, uint32_t flip, bool covering, int left, int right) {
+	int r = randomInt(0, 15);
+	if (r == 0) {
+		return flip ? EVENT_FAR : -EVENT_FAR;
+	}
+	if (r == 1) {
+		return flip ? -EVENT_FAR : EVENT_FAR;
+	}
+	if (covering) {
+		return flip ? randomInt(right, (ROW_BLOCKS + 2) * width) : randomInt(-2 * width, left);
+	}
+	return randomInt(-2 * width, (ROW_BLOCKS + 2) * width);
+}
+
+//count the triangles where the render kernel in use for blocks of WIDTH x HEIGHT pixels disagrees with the scalar one
+template<int WIDTH, int HEIGHT>
+static int testRender() {
+	typedef BlockMask<WIDTH> Mask;
+	std::vector<Mask> bits(ROW_BLOCKS * HEIGHT), expectedBits(ROW_BLOCKS * HEIGHT);
+	std::vector<GLfloat> reference(ROW_BLOCKS), expectedReference(ROW_BLOCKS);
+	std::vector<GLfloat> working(ROW_BLOCKS), expectedWorking(ROW_BLOCKS);
+	int32_t e1x[HEIGHT], e2x[HEIGHT], e3x[HEIGHT];
+
+	int mismatches = 0;
+	for (int t = 0; t < ROW_TRIES; t++) {
+		for (int k = 0; k < ROW_BLOCKS * HEIGHT; k++) {
+			bits[k] = randomMask<WIDTH>();
+		}
+		for (int j = 0; j < ROW_BLOCKS; j++) {
+			reference[j] = randomDepth(0.0f, 1.0f);
+			working[j] = randomInt(0, 3) == 0 ? 0.0f : randomDepth(0.0f, 1.0f);
+		}
+
+		uint32_t o1 = randomInt(0, 1) ? ~0u : 0;
+		uint32_t o2 = randomInt(0, 1) ? ~0u : 0;
+		uint32_t o3 = randomInt(0, 1) ? ~0u : 0;
+		bool covering = randomInt(0, 1) == 0;
+		int left = randomInt(0, ROW_BLOCKS * WIDTH);
+		int right = randomInt(left, ROW_BLOCKS * WIDTH);
+		for (int k = 0; k < HEIGHT; k++) {
+			e1x[k] = randomEvent(WIDTH, o1, covering, left, right);
+			e2x[k] = randomEvent(WIDTH, o2, covering, left, right);
+			e3x[k] = randomEvent(WIDTH, o3, covering, left, right);
+		}
+
+		int jStart = randomInt(0, ROW_BLOCKS - 1);
+		int jEnd = randomInt(jStart, ROW_BLOCKS - 1);
+		GLfloat minZ = randomDepth(0.0f, 1.0f);
+		GLfloat maxZ = randomDepth(minZ, 1.0f);
+		GLfloat maxZStart = randomDepth(minZ - 0.25f, 1.25f);
+		GLfloat maxZStep = randomInt(0, 3) == 0 ? 0.0f : randomDepth(-0.0625f, 0.0625f);
+
+		expectedBits = bits;
+		expectedReference = reference;
+		expectedWorking = working;
+		BlockRow<WIDTH, HEIGHT> expectedRow = { expectedBits.data(), expectedReference.data(), expectedWorking.data() };
+		BlockRow<WIDTH, HEIGHT> row = { bits.data(), reference.data(), working.data() };
+		bool expectedUpdated = renderRowScalar<WIDTH, HEIGHT>(expectedRow, jStart, jEnd, e1x, e2x, e3x, o1, o2, o3, minZ, maxZ, maxZStart, maxZStep);
+		bool updated = Kernels<WIDTH, HEIGHT>::renderRow(row, jStart, jEnd, e1x, e2x, e3x, o1, o2, o3, minZ, maxZ, maxZStart, maxZStep);
+
+		if (updated != expectedUpdated
+			|| std::memcmp(bits.data(), expectedBits.data(), bits.size() * sizeof(Mask)) != 0
+			|| std::memcmp(reference.data(), expectedReference.data(), reference.size() * sizeof(GLfloat)) != 0
+			|| std::memcmp(working.data(), expectedWorking.data(), working.size() * sizeof(GLfloat)) != 0) {
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+//count the ranges of blocks where the test kernel in use disagrees with the scalar one
+static int testTest() {
+	std::vector<GLfloat> reference(ROW_BLOCKS);
+	int mismatches = 0;
+	for (int t = 0; t < ROW_TRIES; t++) {
+		for (int j = 0; j < ROW_BLOCKS; j++) {
+			reference[j] = randomFloat(0.0f, 1.0f);
+		}
+		int jStart = randomInt(0, ROW_BLOCKS - 1);
+		int jEnd = randomInt(jStart, ROW_BLOCKS - 1);
+
+		//depths of blocks in the range are tried too, since a reference depth equal to minZ passes
+		GLfloat minZ = randomInt(0, 1) ? reference[randomInt(jStart, jEnd)] : randomFloat(0.0f, 1.0f);
+		if (testRow(reference.data(), jStart, jEnd, minZ) != testRowScalar(reference.data(), jStart, jEnd, minZ)) {
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+static bool check(const std::string& name, int mismatches, int tries, const char* what) {
+	std::cout << name << ": " << (mismatches == 0 ? "ok" : "FAILED") << " (" << mismatches << " of " << tries << " " << what << " differ)" << std::endl;
+	return mismatches == 0;
+}
+
+static bool checkBoxes(const char* name, int mismatches) {
+	return check(name, mismatches, BOX_COUNT * TRIES, "boxes");
+}
+
+//check the render kernel of this instruction set for blocks of WIDTH x HEIGHT pixels, if it has one of its own
+template<int WIDTH, int HEIGHT>
+static bool checkRender(int isa) {
+	if (Kernels<WIDTH, HEIGHT>::renderRow == renderRowScalar<WIDTH, HEIGHT>) {
+		return true; //the scalar kernel is used
+	}
+	std::string name = std::string("renderRow ") + std::to_string(WIDTH) + "x" + std::to_string(HEIGHT) + " (" + isaName(isa) + ")";
+	return check(name, testRender<WIDTH, HEIGHT>(), ROW_TRIES, "triangles");
+}
+
+int main() {
+	int isa = detectISA();
+	std::cout << "Widest supported instruction set: " << isaName(isa) << std::endl;
+
+	bool ok = true;
+	if (isa >= ISA_SSE41) {
+		ok &= checkBoxes("frustumTestSSE41", testFrustum(frustumTestSSE41));
+		ok &= checkBoxes("projectBoxSSE41", testProject(projectBoxSSE41));
+	}
+	if (isa >= ISA_AVX2) {
+		ok &= checkBoxes("frustumTestAVX2", testFrustum(frustumTestAVX2));
+		ok &= checkBoxes("projectBoxAVX2", testProject(projectBoxAVX2));
+	}
+	if (isa >= ISA_AVX512) {
+		ok &= checkBoxes("frustumTestAVX512", testFrustum(frustumTestAVX512));
+	}
+
+	//the render and test kernels are checked as selectISA picks them for each block size
+	for (int i = ISA_SSE41; i <= isa; i++) {
+		selectISA(i);
+		ok &= checkRender<32, 4>(i);
+		ok &= checkRender<32, 8>(i);
+		ok &= checkRender<32, 16>(i);
+		ok &= checkRender<64, 4>(i);
+		ok &= checkRender<64, 8>(i);
+		ok &= checkRender<64, 16>(i);
+		ok &= check(std::string("testRow (") + isaName(i) + ")", testTest(), ROW_TRIES, "ranges");
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include "threads.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+int threadCount = 1;
+
+static std::vector<std::thread> workers; //worker threads (the main thread isn't in here)
+
+static std::mutex poolMutex; //guards everything below except nextTask
+static std::condition_variable wakeWorkers; //signalled when a job starts or the pool stops
+static std::condition_variable jobDone; //signalled when the last worker finishes a job
+
+static const std::function<void(int)>* job = nullptr; //tasks of the current job
+static int jobTasks = 0; //number of tasks in the current job
+static std::atomic<int> nextTask(0); //next task to hand out
+static int busyWorkers = 0; //workers that haven't finished the current job
+static uint64_t jobID = 0; //incremented for every job, so workers know when there's a new one
+static bool stopping = false;
+
+//take tasks of the current job until there are none left
+static void runTasks() {
+	int i;
+	while ((i = nextTask.fetch_add(1)) < jobTasks) {
+		(*job)(i);
+	}
+}
+
+//loop of each worker thread -- wait for a job, help with it, repeat
+static void workerLoop() {
+	uint64_t lastJob = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(poolMutex);
+			wakeWorkers.wait(lock, [&] { return stopping || jobID != lastJob; });
+			if (stopping) {
+				return;
+			}
+			lastJob = jobID;
+		}
+
+		runTasks();
+
+		std::lock_guard<std::mutex> lock(poolMutex);
+		busyWorkers--;
+		if (busyWorkers == 0) {
+			jobDone.notify_one();
+		}
+	}
+}
+
+//start worker threads -- see header
+void startThreads(int count) {
+	stopThreads();
+	threadCount = count < 1 ? 1 : count;
+	stopping = false;
+	for (int i = 1; i < threadCount; i++) {
+		workers.push_back(std::thread(workerLoop));
+	}
+}
+
+//stop worker threads -- see header
+void stopThreads() {
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		stopping = true;
+	}
+	wakeWorkers.notify_all();
+	for (auto it = workers.begin(); it != workers.end(); it++) {
+		it->join();
+	}
+	workers.clear();
+	threadCount = 1;
+}
+
+//run tasks on all threads and wait for them -- see header
+void parallelFor(int taskCount, const std::function<void(int)>& task) {
+	if (workers.empty() || taskCount <= 1) { //not worth waking the workers
+		for (int i = 0; i < taskCount; i++) {
+			task(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		job = &task;
+		jobTasks = taskCount;
+		nextTask = 0;
+		busyWorkers = (int)workers.size();
+		jobID++;
+	}
+	wakeWorkers.notify_all();
+
+	runTasks(); //the calling thread helps too
+
+	std::unique_lock<std::mutex> lock(poolMutex);
+	jobDone.wait(lock, [] { return busyWorkers == 0; });
+	job = nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/*		threads file
+
+	a small pool of worker threads that the culling logic uses to spread work over several cores
+
+	the workers sleep between jobs, and a job is a number of independent tasks that are handed out
+	to the workers and the calling thread until none are left
+*/
+
+#include <functional>
+
+extern int threadCount; //number of threads used by the culling logic, including the main thread
+
+//start count - 1 worker threads (the calling thread is the other one) -- 1 or less means everything runs on the calling thread
+void startThreads(int count);
+
+//stop and join the worker threads
+void stopThreads();
+
+/*	run task(i) for every i in [0, taskCount) on the workers and the calling thread, and return once all are done
+
+	tasks are taken in increasing order, but may run at the same time, so they shouldn't depend on each other
+*/
+void parallelFor(int taskCount, const std::function<void(int)>& task);
@@ -2,12 +2,6 @@
 #include "cull.h"
 #include <iostream>
 
-//triangle comparator -- for sorting triangles according to their y coordinates
-//sort by decreasing y coordinate
-bool triComp(glm::vec2* p1, glm::vec2* p2) {
-	return p1->y > p2->y;
-}
-
 //Print vec2 to stdout
 void printVec(glm::vec2& v) {
 	std::cout << "[" << v.x << " " << v.y << "]";
@@ -35,6 +29,11 @@ void printBits(uint32_t v) {
 		std::cout << ((v & (1 << (31 - i))) != 0);
 	}
 }
+void printBits(uint64_t v) {
+	for (int i = 0; i < 64; i++) {
+		std::cout << ((v & ((uint64_t)1 << (63 - i))) != 0);
+	}
+}
 
 //operator to print vector to ostream
 template <class T>
@@ -56,7 +55,7 @@ std::vector<std::string> split(std::string str, std::string del) {
 	std::vector<std::string> list;
 
 	size_t i = str.find(del);
-	while (i != -1 && str.length() != 0) {
+	while (i != std::string::npos && str.length() != 0) {
 		std::string left = str.substr(0, i);
 		if (left.length() != 0) {
 			list.push_back(left);
@@ -75,36 +74,6 @@ std::vector<std::string> split(std::string str, std::string del) {
 	return list;
 }
 
-//add epsilons to y coordinates until no points have the same y coordinate -- see header
-void fixTriangle(glm::vec2& t1, glm::vec2& t2, glm::vec2& t3) {
-	//TODO this might cause lockups but in practice it doesn't seem to
-	GLfloat epsilon = 0.001;
-	bool problem = true;
-	int iters = 0;
-
-	while (problem) {
-		iters++;
-		if (iters > 5) {
-			std::cout << "fixTriangle in utility.cpp used " << iters << " iterations -- this should be fixed" << std::endl;
-		}
-		problem = false;
-		if (t1.y == t2.y) {
-			problem = true;
-			t1.y += epsilon;
-		}
-
-		if (t1.y == t3.y) {
-			problem = true;
-			t3.y += epsilon * 0.9f;
-		}
-
-		if (t2.y == t3.y) {
-			problem = true;
-			t3.y += epsilon * 0.8f;
-		}
-	}
-}
-
 /*
 	convert vector from NDC space to pixel space (pixel space of depth buffer)
 
@@ -112,8 +81,8 @@ void fixTriangle(glm::vec2& t1, glm::vec2& t2, glm::vec2& t3) {
 	to be used
 */
 void convertVec(glm::vec2 &v) {
-	int W = BUFFER_WIDTH - 1;
-	int H = BUFFER_HEIGHT - 1;
+	int W = dBuffer.width - 1;
+	int H = dBuffer.height - 1;
 	GLfloat Wf = (GLfloat)W;
 	GLfloat Hf = (GLfloat)H;
 	v.x = (Wf / 2.0) * v.x + (Wf / 2.0);
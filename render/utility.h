@@ -25,9 +25,6 @@
 #define WHITE() std::cout << "\033[1;37m"
 #define RED() std::cout << "\033[1;31m"
 
-//triangle comparator -- for sorting triangles according to their y coordinates
-bool triComp(glm::vec2* p1, glm::vec2* p2);
-
 //Print vectors to stdout
 void printVec(glm::vec2& v);
 void printVec(glm::vec3& v);
@@ -37,8 +34,9 @@ void printVec(glm::vec4& v);
 template<class T>
 void printPair(std::pair<T, T>& p);
 
-//print bits of a 32 bit register -- least significant bit is on the far right
+//print bits of a 32 or 64 bit register -- least significant bit is on the far right
 void printBits(uint32_t v);
+void printBits(uint64_t v);
 
 //operator to print vector to ostream
 template <class T>
@@ -55,13 +53,6 @@ std::ostream& operator<<(std::ostream& os, const std::vector<T>& v);
 */
 std::vector<std::string> split(std::string str, std::string del);
 
-/*	given points of a triangle, add epsilons to the y coordinates until no points have the same
-	y coordinate
-
-	if this causes lockups it might need to be modified
-*/
-void fixTriangle(glm::vec2& t1, glm::vec2& t2, glm::vec2& t3);
-
 /*
 	convert vector from NDC space to pixel space
 